@@ -0,0 +1,72 @@
+#!/bin/bash
+# Benchmarks for minishell.c. Run from anywhere:
+#   ./bench_minishell.sh [benchmark...]
+# With no arguments every benchmark runs. The shell is built into a
+# temporary directory and each benchmark runs it on a generated script.
+
+set -e
+here=$(cd "$(dirname "$0")" && pwd)
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+gcc -O2 -o "$work/minishell" "$here/minishell.c"
+
+# Wall-clock seconds for the shell to run the script on stdin. Arguments
+# are extra environment settings, such as MINISHELL_SPAWN=fork.
+timed() {
+    cat > "$work/script"
+    local TIMEFORMAT=%R
+    { time env "$@" "$work/minishell" "$work/script" > /dev/null 2>&1; } 2>&1
+}
+
+# Pipeline stages run concurrently instead of one after another
+bench_pipeline() {
+    echo "pipeline  yes | head -c 1000000000 | wc -c   $(echo 'yes | head -c 1000000000 | wc -c' | timed) s"
+    echo "pipeline  sleep 1 | sleep 1 | sleep 1        $(echo 'sleep 1 | sleep 1 | sleep 1' | timed) s"
+}
+
+# posix_spawn against fork + execvp for external commands, with the
+# shell's resident set padded to each size in SPAWN_BALLAST_MB. fork
+# copies the page tables, so its cost grows with the shell; posix_spawn's
+# should not.
+bench_spawn() {
+    yes true | head -n 1000 > "$work/trues"
+    for mb in ${SPAWN_BALLAST_MB:-0 256 2048}; do
+        printf 'spawn     1000 x true, %4d MB shell, posix_spawn  %s s\n' "$mb" \
+            "$(timed MINISHELL_BALLAST_MB="$mb" < "$work/trues")"
+        printf 'spawn     1000 x true, %4d MB shell, fork         %s s\n' "$mb" \
+            "$(timed MINISHELL_BALLAST_MB="$mb" MINISHELL_SPAWN=fork < "$work/trues")"
+    done
+}
+
+# The tokenizer: quotes, escapes and comments on every line, then one
+# very long line
+bench_parse() {
+    yes "cd \"/tmp\" 'x' y z w # c" | head -n 1000000 > "$work/lines"
+    echo "parse     1000000 quoted cd lines        $(timed < "$work/lines") s"
+    { printf 'echo'; yes ' word' | head -n 200000 | tr -d '\n'; echo; } > "$work/long"
+    echo "parse     one 200000-word echo line      $(timed < "$work/long") s"
+}
+
+# Builtins in foreground pipelines run in the shell instead of a fork
+bench_builtins() {
+    yes 'echo hello | cat' | head -n 20000 > "$work/echoes"
+    echo "builtins  20000 x echo hello | cat, inline  $(timed < "$work/echoes") s"
+    echo "builtins  20000 x echo hello | cat, forked  $(timed MINISHELL_PIPE_BUILTINS=fork < "$work/echoes") s"
+}
+
+# A persistent coprocess against starting the filter for every call
+bench_coproc() {
+    yes 'sed s/a/A/g <<< banana' | head -n 2000 > "$work/seds"
+    {
+        echo 'coproc -l up sed -u s/a/A/g'
+        yes 'coproc -s up banana' | head -n 2000
+        echo 'coproc -k up'
+    } > "$work/coprocs"
+    echo "coproc    2000 x sed s/a/A/g <<< banana     $(timed < "$work/seds") s"
+    echo "coproc    2000 x coproc -s up banana        $(timed < "$work/coprocs") s"
+}
+
+benchmarks=${*:-pipeline spawn parse builtins coproc}
+for name in $benchmarks; do
+    "bench_$name"
+done
@@ -1,24 +1,290 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <unistd.h>
 #include <sys/wait.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <dirent.h>
 #include <signal.h>
+#include <spawn.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <termios.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
 
-#define MAX_INPUT 1024
-#define MAX_ARGS 64
-#define MAX_COMMANDS 16
+#define READ_BLOCK_SIZE 65536
+#define ARENA_BLOCK_SIZE 65536
+#define HASH_BUCKETS 256
+#define PIPE_CAPACITY 65536
+#define COPROC_TIMEOUT_MS 5000
+
+// Bump allocator for everything parsed from one input line. Blocks are
+// kept across lines; arena_reset just rewinds them.
+typedef struct ArenaBlock {
+    struct ArenaBlock* next;
+    size_t size;
+    size_t used;
+    char data[];
+} ArenaBlock;
+
+typedef struct {
+    ArenaBlock* head;
+    ArenaBlock* current;
+} Arena;
+
+typedef enum {
+    TOKEN_WORD,
+    TOKEN_PIPE,
+    TOKEN_REDIRECT,
+    TOKEN_BACKGROUND
+} TokenType;
+
+typedef enum {
+    REDIRECT_INPUT,         // [n]< file
+    REDIRECT_OUTPUT,        // [n]> file
+    REDIRECT_APPEND,        // [n]>> file
+    REDIRECT_DUP,           // [n]>&m, [n]<&m, or close with [n]>&-
+    REDIRECT_HEREDOC,       // [n]<< word, body from the following lines
+    REDIRECT_HEREDOC_TABS,  // [n]<<- word, leading tabs stripped
+    REDIRECT_HERESTRING     // [n]<<< word
+} RedirectType;
+
+typedef struct Token {
+    TokenType type;
+    char* text;             // Word text, or the operator for redirections
+    RedirectType redirect;
+    int fd;                 // Descriptor a redirection applies to
+    struct Token* next;
+} Token;
+
+// One redirection of a command, applied in the order written
+typedef struct Redirect {
+    RedirectType type;
+    int fd;
+    char* target;           // File name, heredoc body or here-string text
+    int source_fd;          // For REDIRECT_DUP; -1 closes fd
+    struct Redirect* next;
+} Redirect;
+
+// One stage of a parsed pipeline
+typedef struct {
+    char** args;            // NULL-terminated argv
+    int argc;
+    Redirect* redirects;
+    int num_redirects;
+} Command;
+
+typedef struct {
+    Command* commands;
+    int num_commands;
+    int background;         // Ended with &
+    int timed;              // Prefixed with time
+    char* source;           // The line as typed
+    Arena* arena;           // Scratch space for executing this line
+} Pipeline;
+
+// One stage of a pipeline
+typedef struct {
+    pid_t pid;                  // 0 for a builtin run inside the shell
+    char* name;
+    int status;
+    int completed;
+    int stopped;
+    struct timespec started;    // Just before it was spawned
+    long long spawn_us;         // Time spent in fork/posix_spawn
+    struct timespec finished;   // When it ended, as seen by the first wait after SIGCHLD
+    struct rusage usage;        // From wait4, or a getrusage delta for builtins
+} Process;
+
+// A pipeline of processes sharing one process group
+typedef struct Job {
+    int id;                 // Number shown by jobs/fg/bg, 0 until listed
+    pid_t pgid;
+    Process* procs;
+    int num_procs;
+    char* command;          // Command line as typed
+    int timed;              // Prefixed with time
+    struct timespec started;
+    int notified;           // User already told about its current state
+    struct termios tmodes;  // Terminal modes saved when it was stopped
+    int has_tmodes;
+    struct Job* next;
+} Job;
+
+// One step of wiring up a child's descriptors: dup source_fd onto fd, or
+// close fd when source_fd is -1. Owned sources were opened for this
+// command and are closed by the shell once it has started.
+typedef struct {
+    int fd;
+    int source_fd;
+    int owned;
+} FdAction;
+
+// Everything needed to start one external command
+typedef struct {
+    char** args;
+    char* path;         // Resolved executable, filled in by spawn_command
+    FdAction* actions;  // Pipe wiring first, then redirections in order
+    int num_actions;
+    pid_t pgid;         // Process group to join, 0 to lead a new one
+} SpawnRequest;
+
+// How external commands are started
+typedef enum {
+    SPAWN_POSIX,    // posix_spawn (vfork-style, no page table copy)
+    SPAWN_FORK      // fork + execvp
+} SpawnBackend;
+
+SpawnBackend spawn_backend = SPAWN_POSIX;
+int inline_pipe_builtins = 1;   // Run builtins in pipelines without forking
+char* ballast = NULL;           // Resident padding from MINISHELL_BALLAST_MB
+
+// A builtin pipeline stage waiting to run inside the shell
+typedef struct {
+    Command* cmd;
+    int proc_index;     // Its slot in the job, for the exit status
+    SpawnRequest req;   // Its descriptor wiring, every source owned
+} InlineStage;
+
+extern char** environ;
+
+// Buffered line reader for the terminal, a script file or a -c string
+typedef struct {
+    int fd;             // Source descriptor, or -1 for an in-memory string
+    char* buf;          // Block buffer filled with large reads
+    size_t buf_cap;
+    size_t start;       // Next unconsumed byte in buf
+    size_t end;         // One past the last valid byte in buf
+    int eof;
+    char* line;         // Reusable buffer holding the current line
+    size_t line_cap;
+    int timeout_ms;     // Give up on a silent fd after this long, -1 waits forever
+    int timed_out;
+    int reap_children;  // Collect background jobs while blocked on input
+} InputReader;
+
+// A long-lived coprocess started by coproc. The shell keeps both ends of
+// its pipes so repeated requests skip fork and exec entirely.
+typedef struct Worker {
+    char* name;
+    char* command;          // Command line it was started with
+    char** argv;            // The same words, for restarting it
+    pid_t pid;
+    int to_fd;              // Its stdin
+    int from_fd;            // Its stdout
+    InputReader reader;     // Buffers replies read from from_fd
+    int line_mode;          // One reply line per request line, no framing
+    int exited;
+    int status;
+    unsigned long requests;
+    struct Worker* next;
+} Worker;
+
+int interactive = 0;    // Prompts, banner and job control only on a terminal
+int last_status = 0;    // Exit status of the most recent command
+int in_pipeline_stage = 0;  // Running a builtin as a stage, inline or forked
+
+// JSONL per-command resource records, enabled by MINISHELL_STATS=<file>
+FILE* stats_file = NULL;
+
+// Background and stopped jobs, oldest first
+Job* job_list = NULL;
+Job* foreground_job = NULL;     // The pipeline being started or waited for
+volatile sig_atomic_t child_status_changed = 0;
+pid_t shell_pgid;
+struct termios shell_tmodes;
+
+// Coprocesses by name, in the order they were started
+Worker* worker_list = NULL;
+
+// The file commands are read from when it is the shell's own stdin, so
+// coproc -s can refuse to read the script as its request
+int commands_on_stdin = 0;
+struct stat command_input;
+
+// Signals the interactive shell ignores and its children must not
+int job_control_signals[] = { SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU };
 
 // Function prototypes
-void shell_loop();
-char* read_input();
-char** parse_input(char* input);
-int execute_command(char** args);
+void shell_loop(InputReader* reader);
+char* read_input(InputReader* reader);
+void init_reader_fd(InputReader* reader, int fd);
+void init_reader_string(InputReader* reader, char* text);
+int fill_reader(InputReader* reader);
+void* arena_alloc(Arena* arena, size_t size);
+char* arena_reserve(Arena* arena, size_t size);
+void arena_commit(Arena* arena, size_t size);
+void arena_reset(Arena* arena);
+int tokenize(char* input, Arena* arena, Token** tokens);
+Pipeline* parse_input(char* input, Arena* arena, InputReader* reader);
+char* read_heredoc(InputReader* reader, char* delimiter, int strip_tabs, Arena* arena);
+int execute_command(Pipeline* pipeline);
 int execute_builtin(char** args);
-void handle_redirection(char** args);
-void handle_pipes(char* input);
-void execute_single_command(char** args);
+int is_builtin(char* name);
+int run_builtin_redirected(Command* cmd, Arena* arena);
+void init_request(SpawnRequest* req, Command* cmd, Arena* arena);
+void add_fd_action(SpawnRequest* req, int fd, int source_fd, int owned);
+void close_owned_fds(SpawnRequest* req);
+int apply_fd_actions_in_shell(SpawnRequest* req, int* saved_fds);
+void restore_shell_fds(SpawnRequest* req, int* saved_fds);
+int handle_redirection(Command* cmd, SpawnRequest* req);
+int open_here_document(char* body);
+void handle_pipes(Pipeline* pipeline);
+void run_inline_builtins(Job* job, InlineStage* stages, int num_stages);
+void wait_for_job(Job* job);
+Job* create_job(Pipeline* pipeline);
+void free_job(Job* job);
+void add_job(Job* job);
+void remove_job(Job* job);
+Job* find_job(char* spec);
+int update_process(Job* job, pid_t pid, int status, struct rusage* usage);
+void record_child(pid_t pid, int status, struct rusage* usage);
+Process* add_builtin_process(Job* job, char* name);
+void begin_builtin_usage(Process* proc, struct rusage* before);
+void end_builtin_usage(Process* proc, struct rusage* before);
+void finish_job(Job* job);
+void print_job_times(Job* job);
+void write_job_stats(Job* job);
+void write_json_string(FILE* fp, char* text);
+long long elapsed_us(struct timespec* from, struct timespec* to);
+long long timeval_us(struct timeval* tv);
+void init_stats();
+int job_is_completed(Job* job);
+int job_is_stopped(Job* job);
+void set_status_from_job(Job* job);
+int exit_code(int status);
+void run_foreground_job(Job* job, int resume);
+void sigchld_handler(int sig);
+void reap_background_jobs();
+void notify_jobs();
+void init_job_control();
+void reset_child_signals();
+int launch_process(Job* job, SpawnRequest* req);
+pid_t spawn_command(SpawnRequest* req);
+pid_t spawn_posix(SpawnRequest* req);
+pid_t spawn_fork(SpawnRequest* req);
+void close_exec_fds();
+void select_spawn_backend();
+void init_ballast();
+char* resolve_command(char* name, int* from_cache);
+char* search_path(char* name);
+void forget_command(char* name);
+void clear_command_hash();
+unsigned int hash_name(char* name);
+void report_job_status(Job* job);
+Worker* find_worker(char* name);
+Worker* start_worker(char* name, char** args, int line_mode);
+int launch_worker(Worker* worker);
+void restart_worker(Worker* worker);
+void stop_worker(Worker* worker);
+int worker_request(Worker* worker, char* payload, size_t len);
+int write_all(int fd, char* data, size_t len);
+int builtin_reads_stdin(char** args);
 
 // Built-in command functions
 int shell_cd(char** args);
@@ -26,6 +292,12 @@ int shell_pwd(char** args);
 int shell_echo(char** args);
 int shell_exit(char** args);
 int shell_help(char** args);
+int shell_hash(char** args);
+int shell_jobs(char** args);
+int shell_fg(char** args);
+int shell_bg(char** args);
+int shell_wait(char** args);
+int shell_coproc(char** args);
 
 // Built-in command names and functions
 char* builtin_commands[] = {
@@ -33,7 +305,13 @@ char* builtin_commands[] = {
     "pwd", 
     "echo",
     "exit",
-    "help"
+    "help",
+    "hash",
+    "jobs",
+    "fg",
+    "bg",
+    "wait",
+    "coproc"
 };
 
 int (*builtin_functions[])(char**) = {
@@ -41,274 +319,2146 @@ int (*builtin_functions[])(char**) = {
     &shell_pwd,
     &shell_echo,
     &shell_exit,
-    &shell_help
+    &shell_help,
+    &shell_hash,
+    &shell_jobs,
+    &shell_fg,
+    &shell_bg,
+    &shell_wait,
+    &shell_coproc
 };
 
 int num_builtins() {
     return sizeof(builtin_commands) / sizeof(char*);
 }
 
-int main() {
-    printf("=== Mini Shell ===\n");
-    printf("Type 'help' for available commands\n");
+// Cached PATH lookups: command name -> absolute path
+typedef struct HashEntry {
+    char* name;
+    char* path;
+    int hits;
+    struct HashEntry* next;
+} HashEntry;
+
+HashEntry* command_hash[HASH_BUCKETS];
+char* hashed_path_env = NULL;   // $PATH the cached entries were resolved against
+unsigned long hash_hits = 0;
+unsigned long hash_misses = 0;
+
+int main(int argc, char** argv) {
+    InputReader reader;
+    
+    // minishell -c 'commands' | minishell script.sh | minishell
+    if (argc > 2 && strcmp(argv[1], "-c") == 0) {
+        init_reader_string(&reader, argv[2]);
+    } else if (argc > 1) {
+        int fd = open(argv[1], O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            perror(argv[1]);
+            return 127;
+        }
+        init_reader_fd(&reader, fd);
+    } else {
+        init_reader_fd(&reader, STDIN_FILENO);
+        interactive = isatty(STDIN_FILENO);
+        commands_on_stdin = fstat(STDIN_FILENO, &command_input) == 0;
+    }
+    reader.reap_children = 1;
+    
+    if (interactive) {
+        printf("=== Mini Shell ===\n");
+        printf("Type 'help' for available commands\n");
+    }
+    
+    init_job_control();
+    select_spawn_backend();
+    init_ballast();
+    init_stats();
+    shell_loop(&reader);
+    
+    return last_status;
+}
+
+void shell_loop(InputReader* reader) {
+    Arena arena = { NULL, NULL };
+    char* input;
+    int status = 1;
+    
+    do {
+        // Collect finished background jobs before showing the prompt
+        reap_background_jobs();
+        notify_jobs();
+        
+        if (interactive) {
+            printf("minishell> ");
+            fflush(stdout);
+        }
+        
+        input = read_input(reader);
+        if (input == NULL) {
+            if (interactive) {
+                printf("\nGoodbye!\n");
+            }
+            break;
+        }
+        
+        // Everything parsed from the line lives in the arena until the
+        // next line rewinds it
+        arena_reset(&arena);
+        Pipeline* pipeline = parse_input(input, &arena, reader);
+        if (pipeline == NULL) {
+            last_status = 2;
+        } else if (pipeline->num_commands > 0) {
+            status = execute_command(pipeline);
+        }
+    } while (status);
+}
+
+void init_reader_fd(InputReader* reader, int fd) {
+    reader->fd = fd;
+    reader->buf_cap = READ_BLOCK_SIZE;
+    reader->buf = malloc(reader->buf_cap);
+    reader->start = 0;
+    reader->end = 0;
+    reader->eof = 0;
+    reader->line_cap = 256;
+    reader->line = malloc(reader->line_cap);
+    reader->timeout_ms = -1;
+    reader->timed_out = 0;
+    reader->reap_children = 0;
+    if (!reader->buf || !reader->line) {
+        fprintf(stderr, "Memory allocation error\n");
+        exit(1);
+    }
+}
+
+// A -c string is served straight out of argv without copying
+void init_reader_string(InputReader* reader, char* text) {
+    reader->fd = -1;
+    reader->buf = text;
+    reader->buf_cap = strlen(text);
+    reader->start = 0;
+    reader->end = reader->buf_cap;
+    reader->eof = 1;
+    reader->line_cap = 256;
+    reader->line = malloc(reader->line_cap);
+    reader->timeout_ms = -1;
+    reader->timed_out = 0;
+    reader->reap_children = 0;
+    if (!reader->line) {
+        fprintf(stderr, "Memory allocation error\n");
+        exit(1);
+    }
+}
+
+// Refill the block buffer with one large read; returns bytes read
+int fill_reader(InputReader* reader) {
+    if (reader->eof) {
+        return 0;
+    }
+    
+    reader->start = 0;
+    reader->end = 0;
+    
+    // poll is never restarted after a signal, so SIGCHLD wakes the
+    // shell's own reader up to reap a job the moment it ends
+    if (reader->timeout_ms >= 0 || reader->reap_children) {
+        struct pollfd pfd = { reader->fd, POLLIN, 0 };
+        int ready;
+        while ((ready = poll(&pfd, 1, reader->timeout_ms)) == -1 && errno == EINTR) {
+            if (reader->reap_children) {
+                reap_background_jobs();
+            }
+        }
+        if (ready == 0) {
+            reader->timed_out = 1;
+            return 0;
+        }
+    }
+    
+    ssize_t n;
+    do {
+        n = read(reader->fd, reader->buf, reader->buf_cap);
+    } while (n == -1 && errno == EINTR);
+    
+    if (n == -1) {
+        perror("read_input");
+        exit(1);
+    }
+    if (n == 0) {
+        reader->eof = 1;
+        return 0;
+    }
+    reader->end = n;
+    return n;
+}
+
+// Return the next line without its newline, or NULL at end of input.
+// The line lives in the reader's buffer and is overwritten by the next call.
+char* read_input(InputReader* reader) {
+    size_t len = 0;
+    
+    while (1) {
+        if (reader->start == reader->end && fill_reader(reader) == 0) {
+            if (len == 0) {
+                return NULL;
+            }
+            break; // Last line had no trailing newline
+        }
+        
+        char* chunk = reader->buf + reader->start;
+        size_t avail = reader->end - reader->start;
+        char* newline = memchr(chunk, '\n', avail);
+        size_t take = newline ? (size_t)(newline - chunk) : avail;
+        
+        if (len + take + 1 > reader->line_cap) {
+            while (len + take + 1 > reader->line_cap) {
+                reader->line_cap *= 2;
+            }
+            reader->line = realloc(reader->line, reader->line_cap);
+            if (!reader->line) {
+                fprintf(stderr, "Memory allocation error\n");
+                exit(1);
+            }
+        }
+        memcpy(reader->line + len, chunk, take);
+        len += take;
+        
+        if (newline) {
+            reader->start += take + 1;
+            break;
+        }
+        reader->start = reader->end;
+    }
+    
+    reader->line[len] = '\0';
+    return reader->line;
+}
+
+void* arena_alloc(Arena* arena, size_t size) {
+    // Keep pointers aligned for the token and command structs
+    size = (size + 15) & ~(size_t)15;
+    void* ptr = arena_reserve(arena, size);
+    arena_commit(arena, size);
+    return ptr;
+}
+
+// Make at least size bytes available at the top of the arena without
+// claiming them, so a caller can write first and commit the actual length
+char* arena_reserve(Arena* arena, size_t size) {
+    ArenaBlock* block = arena->current;
+    
+    while (block != NULL && block->size - block->used < size) {
+        // Later blocks were rewound by arena_reset and may be reused
+        block = block->next;
+        if (block != NULL) {
+            block->used = 0;
+        }
+    }
+    
+    if (block == NULL) {
+        // Twice the request: each word of a long line reserves the rest
+        // of the line, and this way they share blocks instead of each
+        // getting one of its own
+        size_t block_size = 2 * size > ARENA_BLOCK_SIZE ? 2 * size : ARENA_BLOCK_SIZE;
+        block = malloc(sizeof(ArenaBlock) + block_size);
+        if (!block) {
+            fprintf(stderr, "Memory allocation error\n");
+            exit(1);
+        }
+        block->size = block_size;
+        block->used = 0;
+        block->next = NULL;
+        
+        // Append after the current block so the chain stays in use order
+        if (arena->current == NULL) {
+            arena->head = block;
+        } else {
+            block->next = arena->current->next;
+            arena->current->next = block;
+        }
+    }
+    
+    arena->current = block;
+    return block->data + block->used;
+}
+
+void arena_commit(Arena* arena, size_t size) {
+    arena->current->used += size;
+}
+
+void arena_reset(Arena* arena) {
+    arena->current = arena->head;
+    if (arena->head != NULL) {
+        arena->head->used = 0;
+    }
+}
+
+// Single pass over the line. Words are unquoted straight into the arena;
+// a word can never be longer than the rest of the line, so that much is
+// reserved up front and only the used part is committed.
+// Returns -1 on a syntax error.
+int tokenize(char* input, Arena* arena, Token** tokens) {
+    Token** tail = tokens;
+    char* c = input;
+    char* end = input + strlen(input);
+    
+    *tokens = NULL;
+    
+    while (1) {
+        while (*c == ' ' || *c == '\t' || *c == '\r' || *c == '\a') {
+            c++;
+        }
+        if (*c == '\0' || *c == '#') {
+            break; // End of line or comment
+        }
+        
+        Token* token = arena_alloc(arena, sizeof(Token));
+        token->next = NULL;
+        token->text = NULL;
+        token->fd = -1;
+        *tail = token;
+        tail = &token->next;
+        
+        // Digits directly before < or > name the descriptor, as in 2>&1
+        char* digits_end = c;
+        while (*digits_end >= '0' && *digits_end <= '9') {
+            digits_end++;
+        }
+        if (digits_end > c && (*digits_end == '<' || *digits_end == '>')) {
+            token->fd = atoi(c);
+            c = digits_end;
+        }
+        
+        if (*c == '<' || *c == '>') {
+            token->type = TOKEN_REDIRECT;
+            if (strncmp(c, "<<<", 3) == 0) {
+                token->redirect = REDIRECT_HERESTRING;
+                token->text = "<<<";
+            } else if (strncmp(c, "<<-", 3) == 0) {
+                token->redirect = REDIRECT_HEREDOC_TABS;
+                token->text = "<<-";
+            } else if (strncmp(c, "<<", 2) == 0) {
+                token->redirect = REDIRECT_HEREDOC;
+                token->text = "<<";
+            } else if (strncmp(c, "<&", 2) == 0) {
+                token->redirect = REDIRECT_DUP;
+                token->text = "<&";
+            } else if (strncmp(c, ">>", 2) == 0) {
+                token->redirect = REDIRECT_APPEND;
+                token->text = ">>";
+            } else if (strncmp(c, ">&", 2) == 0) {
+                token->redirect = REDIRECT_DUP;
+                token->text = ">&";
+            } else if (strncmp(c, ">|", 2) == 0) {
+                token->redirect = REDIRECT_OUTPUT;
+                token->text = ">|";
+            } else if (*c == '<') {
+                token->redirect = REDIRECT_INPUT;
+                token->text = "<";
+            } else {
+                token->redirect = REDIRECT_OUTPUT;
+                token->text = ">";
+            }
+            
+            c += strlen(token->text);
+            if (token->fd == -1) {
+                token->fd = token->text[0] == '<' ? STDIN_FILENO : STDOUT_FILENO;
+            }
+            continue;
+        }
+        
+        if (*c == '|') {
+            token->type = TOKEN_PIPE;
+            c++;
+            continue;
+        }
+        if (*c == '&') {
+            token->type = TOKEN_BACKGROUND;
+            c++;
+            continue;
+        }
+        
+        token->type = TOKEN_WORD;
+        char* out = arena_reserve(arena, end - c + 1);
+        char* word = out;
+        
+        while (*c != '\0' && strchr(" \t\r\a|<>&", *c) == NULL) {
+            if (*c == '\'') {
+                // Single quotes: everything literal up to the closing quote
+                c++;
+                while (*c != '\0' && *c != '\'') {
+                    *out++ = *c++;
+                }
+                if (*c == '\0') {
+                    fprintf(stderr, "Syntax error: unterminated quote\n");
+                    return -1;
+                }
+                c++;
+            } else if (*c == '"') {
+                // Double quotes: backslash only escapes \ " $ and `
+                c++;
+                while (*c != '\0' && *c != '"') {
+                    if (*c == '\\' && c[1] != '\0' && strchr("\\\"$`", c[1]) != NULL) {
+                        c++;
+                    }
+                    *out++ = *c++;
+                }
+                if (*c == '\0') {
+                    fprintf(stderr, "Syntax error: unterminated quote\n");
+                    return -1;
+                }
+                c++;
+            } else if (*c == '\\') {
+                c++;
+                if (*c != '\0') {
+                    *out++ = *c++;
+                }
+            } else {
+                *out++ = *c++;
+            }
+        }
+        
+        *out++ = '\0';
+        token->text = word;
+        arena_commit(arena, out - word);
+    }
+    
+    return 0;
+}
+
+// Build the pipeline for one line. Returns NULL on a syntax error and an
+// empty pipeline for a blank line. Heredoc bodies are read from the lines
+// that follow.
+Pipeline* parse_input(char* input, Arena* arena, InputReader* reader) {
+    Pipeline* pipeline = arena_alloc(arena, sizeof(Pipeline));
+    pipeline->commands = NULL;
+    pipeline->num_commands = 0;
+    pipeline->background = 0;
+    pipeline->timed = 0;
+    pipeline->source = input;
+    pipeline->arena = arena;
+    
+    Token* tokens;
+    if (tokenize(input, arena, &tokens) == -1) {
+        return NULL;
+    }
+    if (tokens == NULL) {
+        return pipeline;
+    }
+    
+    // A leading time reports resource usage once the pipeline finishes
+    if (tokens->type == TOKEN_WORD && strcmp(tokens->text, "time") == 0 &&
+        tokens->next != NULL) {
+        pipeline->timed = 1;
+        tokens = tokens->next;
+    }
+    
+    // & is only allowed at the very end and sends the pipeline to the background
+    for (Token** link = &tokens; *link != NULL; link = &(*link)->next) {
+        if ((*link)->type == TOKEN_BACKGROUND) {
+            if ((*link)->next != NULL || link == &tokens) {
+                fprintf(stderr, "Syntax error: unexpected '&'\n");
+                return NULL;
+            }
+            pipeline->background = 1;
+            *link = NULL;
+            break;
+        }
+    }
+    
+    // Count stages and words first so every array gets its exact size
+    int num_commands = 1;
+    int has_heredoc = 0;
+    for (Token* t = tokens; t != NULL; t = t->next) {
+        if (t->type == TOKEN_PIPE) {
+            num_commands++;
+        } else if (t->type == TOKEN_REDIRECT && (t->redirect == REDIRECT_HEREDOC ||
+                                                 t->redirect == REDIRECT_HEREDOC_TABS)) {
+            has_heredoc = 1;
+        }
+    }
+    
+    // Reading heredoc lines reuses the reader's line buffer
+    if (has_heredoc) {
+        size_t len = strlen(input) + 1;
+        pipeline->source = memcpy(arena_alloc(arena, len), input, len);
+    }
+    
+    pipeline->commands = arena_alloc(arena, num_commands * sizeof(Command));
+    pipeline->num_commands = num_commands;
+    
+    Token* t = tokens;
+    for (int i = 0; i < num_commands; i++) {
+        Command* cmd = &pipeline->commands[i];
+        Redirect** redirect_tail = &cmd->redirects;
+        cmd->argc = 0;
+        cmd->redirects = NULL;
+        cmd->num_redirects = 0;
+        
+        int words = 0;
+        for (Token* scan = t; scan != NULL && scan->type != TOKEN_PIPE; scan = scan->next) {
+            if (scan->type == TOKEN_WORD) {
+                words++;
+            }
+        }
+        cmd->args = arena_alloc(arena, (words + 1) * sizeof(char*));
+        
+        for (; t != NULL && t->type != TOKEN_PIPE; t = t->next) {
+            if (t->type == TOKEN_WORD) {
+                cmd->args[cmd->argc++] = t->text;
+                continue;
+            }
+            
+            // Redirection operators take the next word as their target
+            Token* target = t->next;
+            if (target == NULL || target->type != TOKEN_WORD) {
+                fprintf(stderr, "Syntax error: expected word after '%s'\n", t->text);
+                return NULL;
+            }
+            
+            Redirect* redirect = arena_alloc(arena, sizeof(Redirect));
+            redirect->type = t->redirect;
+            redirect->fd = t->fd;
+            redirect->target = target->text;
+            redirect->source_fd = -1;
+            redirect->next = NULL;
+            
+            if (t->redirect == REDIRECT_DUP) {
+                char* end;
+                if (strcmp(target->text, "-") != 0) {
+                    long source_fd = strtol(target->text, &end, 10);
+                    if (*end != '\0' || end == target->text || source_fd < 0) {
+                        fprintf(stderr, "Syntax error: bad file descriptor '%s'\n", target->text);
+                        return NULL;
+                    }
+                    redirect->source_fd = source_fd;
+                }
+            } else if (t->redirect == REDIRECT_HEREDOC || t->redirect == REDIRECT_HEREDOC_TABS) {
+                redirect->target = read_heredoc(reader, target->text,
+                                                t->redirect == REDIRECT_HEREDOC_TABS, arena);
+                redirect->type = REDIRECT_HEREDOC;
+            } else if (t->redirect == REDIRECT_HERESTRING) {
+                // A here-string is its word plus a trailing newline
+                size_t len = strlen(target->text);
+                redirect->target = arena_alloc(arena, len + 2);
+                memcpy(redirect->target, target->text, len);
+                redirect->target[len] = '\n';
+                redirect->target[len + 1] = '\0';
+            }
+            
+            *redirect_tail = redirect;
+            redirect_tail = &redirect->next;
+            cmd->num_redirects++;
+            t = target;
+        }
+        cmd->args[cmd->argc] = NULL;
+        
+        if (cmd->argc == 0) {
+            fprintf(stderr, "Syntax error: empty pipeline stage\n");
+            return NULL;
+        }
+        
+        if (t != NULL) {
+            t = t->next; // Skip the pipe
+        }
+    }
+    
+    return pipeline;
+}
+
+// Collect heredoc lines up to the delimiter into one arena string
+char* read_heredoc(InputReader* reader, char* delimiter, int strip_tabs, Arena* arena) {
+    size_t len = 0, cap = 256;
+    char* body = malloc(cap);
+    if (!body) {
+        fprintf(stderr, "Memory allocation error\n");
+        exit(1);
+    }
+    
+    while (1) {
+        if (interactive) {
+            printf("> ");
+            fflush(stdout);
+        }
+        
+        char* line = read_input(reader);
+        if (line == NULL) {
+            fprintf(stderr, "Warning: here-document delimited by end of input (wanted '%s')\n",
+                    delimiter);
+            break;
+        }
+        if (strip_tabs) {
+            while (*line == '\t') {
+                line++;
+            }
+        }
+        if (strcmp(line, delimiter) == 0) {
+            break;
+        }
+        
+        size_t line_len = strlen(line);
+        if (len + line_len + 2 > cap) {
+            while (len + line_len + 2 > cap) {
+                cap *= 2;
+            }
+            body = realloc(body, cap);
+            if (!body) {
+                fprintf(stderr, "Memory allocation error\n");
+                exit(1);
+            }
+        }
+        memcpy(body + len, line, line_len);
+        len += line_len;
+        body[len++] = '\n';
+    }
+    
+    char* copy = arena_alloc(arena, len + 1);
+    memcpy(copy, body, len);
+    copy[len] = '\0';
+    free(body);
+    return copy;
+}
+
+int execute_command(Pipeline* pipeline) {
+    Command* cmd = &pipeline->commands[0];
+    
+    // A lone builtin runs in the shell itself so cd and exit take effect
+    if (pipeline->num_commands == 1 && !pipeline->background && is_builtin(cmd->args[0])) {
+        if (!pipeline->timed && stats_file == NULL) {
+            return run_builtin_redirected(cmd, pipeline->arena);
+        }
+        
+        // Measure it as a one-stage job so it can be timed and logged
+        Job* job = create_job(pipeline);
+        Process* proc = add_builtin_process(job, cmd->args[0]);
+        struct rusage before;
+        
+        begin_builtin_usage(proc, &before);
+        int result = run_builtin_redirected(cmd, pipeline->arena);
+        end_builtin_usage(proc, &before);
+        
+        run_foreground_job(job, 0);
+        return result;
+    }
+    
+    handle_pipes(pipeline);
+    return 1;
+}
+
+int execute_builtin(char** args) {
+    for (int i = 0; i < num_builtins(); i++) {
+        if (strcmp(args[0], builtin_commands[i]) == 0) {
+            last_status = 0; // Builtins set it themselves on failure
+            return (*builtin_functions[i])(args);
+        }
+    }
+    return -1; // Not a built-in command
+}
+
+int is_builtin(char* name) {
+    for (int i = 0; i < num_builtins(); i++) {
+        if (strcmp(name, builtin_commands[i]) == 0) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Run a builtin in the shell with its redirections applied temporarily
+int run_builtin_redirected(Command* cmd, Arena* arena) {
+    SpawnRequest req;
+    init_request(&req, cmd, arena);
+    
+    if (handle_redirection(cmd, &req) == -1) {
+        last_status = 1;
+        return 1;
+    }
+    
+    int* saved_fds = arena_alloc(arena, (req.num_actions + 1) * sizeof(int));
+    int result = 1;
+    if (apply_fd_actions_in_shell(&req, saved_fds) == 0) {
+        result = execute_builtin(cmd->args);
+    } else {
+        last_status = 1;
+    }
+    restore_shell_fds(&req, saved_fds);
+    close_owned_fds(&req);
+    return result;
+}
+
+// Room for stdin/stdout pipe wiring plus every redirection of the command
+void init_request(SpawnRequest* req, Command* cmd, Arena* arena) {
+    req->args = cmd->args;
+    req->path = NULL;
+    req->actions = arena_alloc(arena, (cmd->num_redirects + 2) * sizeof(FdAction));
+    req->num_actions = 0;
+    req->pgid = 0;
+}
+
+void add_fd_action(SpawnRequest* req, int fd, int source_fd, int owned) {
+    FdAction* action = &req->actions[req->num_actions++];
+    action->fd = fd;
+    action->source_fd = source_fd;
+    action->owned = owned;
+}
+
+void close_owned_fds(SpawnRequest* req) {
+    for (int i = 0; i < req->num_actions; i++) {
+        if (req->actions[i].owned) {
+            close(req->actions[i].source_fd);
+            req->actions[i].owned = 0;
+        }
+    }
+}
+
+// Apply a request's descriptor wiring to the shell itself, remembering the
+// originals in saved_fds (-1 where the descriptor was closed)
+int apply_fd_actions_in_shell(SpawnRequest* req, int* saved_fds) {
+    fflush(stdout);
+    fflush(stderr);
+    
+    for (int i = 0; i < req->num_actions; i++) {
+        FdAction* action = &req->actions[i];
+        saved_fds[i] = fcntl(action->fd, F_DUPFD_CLOEXEC, 10);
+        
+        int result = action->source_fd == -1 ? close(action->fd)
+                                             : dup2(action->source_fd, action->fd);
+        if (result == -1 && action->source_fd != -1) {
+            fprintf(stderr, "Redirection failed: %d: %s\n", action->source_fd, strerror(errno));
+            req->num_actions = i + 1;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void restore_shell_fds(SpawnRequest* req, int* saved_fds) {
+    fflush(stdout);
+    fflush(stderr);
+    clearerr(stdout);
+    
+    for (int i = req->num_actions - 1; i >= 0; i--) {
+        int fd = req->actions[i].fd;
+        if (saved_fds[i] != -1) {
+            dup2(saved_fds[i], fd);
+            close(saved_fds[i]);
+        } else {
+            close(fd);
+        }
+    }
+}
+
+// Turn a command's redirections into descriptor actions. Files are opened
+// in the shell so errors are reported precisely; the spawn backend only has
+// to dup them into place. They come after any pipe wiring already in the
+// request, so 2>&1 in a pipeline stage follows stdout into the pipe.
+int handle_redirection(Command* cmd, SpawnRequest* req) {
+    int first_action = req->num_actions;
+    
+    for (Redirect* redirect = cmd->redirects; redirect != NULL; redirect = redirect->next) {
+        int fd = -1;
+        
+        switch (redirect->type) {
+            case REDIRECT_INPUT:
+                fd = open(redirect->target, O_RDONLY | O_CLOEXEC);
+                break;
+            case REDIRECT_OUTPUT:
+                fd = open(redirect->target, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+                break;
+            case REDIRECT_APPEND:
+                fd = open(redirect->target, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+                break;
+            case REDIRECT_HEREDOC:
+            case REDIRECT_HEREDOC_TABS:
+            case REDIRECT_HERESTRING:
+                fd = open_here_document(redirect->target);
+                break;
+            case REDIRECT_DUP:
+                add_fd_action(req, redirect->fd, redirect->source_fd, 0);
+                continue;
+        }
+        
+        if (fd == -1) {
+            fprintf(stderr, "%s redirection failed: %s: %s\n",
+                    redirect->type == REDIRECT_INPUT ? "Input" : "Output",
+                    redirect->target, strerror(errno));
+            
+            // Undo the descriptors this command already opened
+            for (int i = first_action; i < req->num_actions; i++) {
+                if (req->actions[i].owned) {
+                    close(req->actions[i].source_fd);
+                }
+            }
+            req->num_actions = first_action;
+            return -1;
+        }
+        add_fd_action(req, redirect->fd, fd, 1);
+    }
+    return 0;
+}
+
+// Heredocs and here-strings are served from memory: a memfd holds the
+// body and is rewound for the reader, so nothing touches the disk. A pipe
+// is the fallback when memfd_create is unavailable and the body fits.
+int open_here_document(char* body) {
+    size_t len = strlen(body);
+    int fd = memfd_create("minishell-heredoc", MFD_CLOEXEC);
+    
+    if (fd != -1) {
+        size_t written = 0;
+        while (written < len) {
+            ssize_t n = write(fd, body + written, len - written);
+            if (n == -1) {
+                close(fd);
+                return -1;
+            }
+            written += n;
+        }
+        lseek(fd, 0, SEEK_SET);
+        return fd;
+    }
+    
+    int pipe_fds[2];
+    if (len > PIPE_CAPACITY || pipe2(pipe_fds, O_CLOEXEC) == -1) {
+        errno = E2BIG;
+        return -1;
+    }
+    if (write(pipe_fds[1], body, len) != (ssize_t)len) {
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+        return -1;
+    }
+    close(pipe_fds[1]);
+    return pipe_fds[0];
+}
+
+void handle_pipes(Pipeline* pipeline) {
+    int num_commands = pipeline->num_commands;
+    Job* job = create_job(pipeline);
+    foreground_job = pipeline->background ? NULL : job;
+    InlineStage* inline_stages = NULL;
+    int num_inline = 0;
+    
+    int pipe_fds[2];
+    int input_fd = -1;
+    
+    // Without job control a background job must not compete for our input
+    if (pipeline->background && !interactive) {
+        input_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    }
+    
+    // Start all stages up front so they run concurrently
+    for (int i = 0; i < num_commands; i++) {
+        Command* cmd = &pipeline->commands[i];
+        SpawnRequest req;
+        init_request(&req, cmd, pipeline->arena);
+        
+        // Builtins in a foreground pipeline run in the shell after all the
+        // external stages are started, so only external commands fork
+        int run_inline = inline_pipe_builtins && !pipeline->background &&
+                         is_builtin(cmd->args[0]) && !builtin_reads_stdin(cmd->args);
+        
+        // Inline builtins don't read stdin, so they get no pipe input;
+        // dropping our read end lets the upstream stage see EPIPE
+        if (input_fd != -1 && !run_inline) {
+            add_fd_action(&req, STDIN_FILENO, input_fd, 0);
+        }
+        
+        int pipe_output = -1;
+        if (i < num_commands - 1) {
+            // Create pipe for all but the last command; close-on-exec keeps
+            // stray pipe ends out of every stage that doesn't own them
+            if (pipe2(pipe_fds, O_CLOEXEC) == -1) {
+                perror("Pipe creation failed");
+                break;
+            }
+            pipe_output = pipe_fds[1];
+            add_fd_action(&req, STDOUT_FILENO, pipe_output, 0);
+        }
+        
+        // A stage that fails to start just leaves its reader at EOF
+        if (handle_redirection(cmd, &req) == -1) {
+            last_status = 1;
+        } else if (run_inline) {
+            if (inline_stages == NULL) {
+                inline_stages = arena_alloc(pipeline->arena, num_commands * sizeof(InlineStage));
+            }
+            
+            // The pipe end is closed below, so keep our own copy
+            for (int j = 0; j < req.num_actions; j++) {
+                FdAction* action = &req.actions[j];
+                if (!action->owned && action->source_fd == pipe_output && pipe_output != -1) {
+                    action->source_fd = fcntl(action->source_fd, F_DUPFD_CLOEXEC, 0);
+                    action->owned = 1;
+                }
+            }
+            
+            InlineStage* stage = &inline_stages[num_inline++];
+            stage->cmd = cmd;
+            stage->req = req;
+            stage->proc_index = job->num_procs;
+            add_builtin_process(job, cmd->args[0]);
+        } else {
+            launch_process(job, &req);
+            close_owned_fds(&req);
+        }
+        
+        if (input_fd != -1) {
+            close(input_fd);
+            input_fd = -1;
+        }
+        
+        if (i < num_commands - 1) {
+            close(pipe_fds[1]);
+            input_fd = pipe_fds[0];
+        }
+    }
+    
+    if (input_fd != -1) {
+        close(input_fd);
+    }
+    
+    if (num_inline > 0) {
+        run_inline_builtins(job, inline_stages, num_inline);
+    }
+    
+    if (job->num_procs == 0) {
+        foreground_job = NULL;
+        free_job(job);
+        return;
+    }
+    
+    if (pipeline->background) {
+        add_job(job);
+        last_status = 0;
+        if (interactive) {
+            printf("[%d] %d\n", job->id, (int)job->procs[job->num_procs - 1].pid);
+        }
+        return;
+    }
+    
+    run_foreground_job(job, 0);
+    foreground_job = NULL;
+}
+
+// Run the builtin stages of a pipeline in the shell, each with its output
+// pointed at its pipe or redirections. The external stages are already
+// running, so pipe readers exist and large outputs can't deadlock.
+void run_inline_builtins(Job* job, InlineStage* stages, int num_stages) {
+    // Downstream stages may read the terminal; give it to them now
+    if (interactive && job->pgid != 0) {
+        tcsetpgrp(STDIN_FILENO, job->pgid);
+    }
+    
+    // A reader that exits early must not kill the shell with SIGPIPE
+    struct sigaction ignore_pipe, saved_pipe;
+    memset(&ignore_pipe, 0, sizeof(ignore_pipe));
+    ignore_pipe.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &ignore_pipe, &saved_pipe);
+    
+    // A stage's status only reaches last_status through the job, as it
+    // would from a forked stage
+    int saved_status = last_status;
+    in_pipeline_stage = 1;
+    for (int i = 0; i < num_stages; i++) {
+        InlineStage* stage = &stages[i];
+        Process* proc = &job->procs[stage->proc_index];
+        int saved_fds[stage->req.num_actions + 1];
+        struct rusage before;
+        
+        begin_builtin_usage(proc, &before);
+        if (apply_fd_actions_in_shell(&stage->req, saved_fds) == 0) {
+            // exit inside a pipeline only ends that stage, as in other shells
+            execute_builtin(stage->cmd->args);
+        } else {
+            last_status = 1;
+        }
+        restore_shell_fds(&stage->req, saved_fds);
+        end_builtin_usage(proc, &before);
+        last_status = saved_status;
+        
+        close_owned_fds(&stage->req);
+    }
+    in_pipeline_stage = 0;
+    
+    sigaction(SIGPIPE, &saved_pipe, NULL);
+}
+
+// Wait until every stage of a job has finished or, with job control, until
+// the job stops. Stages are reaped in whatever order they finish. Any
+// child is waited for, so a background job or coprocess that ends in the
+// meantime is recorded when it exits rather than at the next prompt.
+void wait_for_job(Job* job) {
+    while (!job_is_completed(job) && !job_is_stopped(job)) {
+        int status;
+        struct rusage usage;
+        pid_t pid = wait4(-1, &status, interactive ? WUNTRACED : 0, &usage);
+        if (pid == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror("wait4");
+            break;
+        }
+        if (!update_process(job, pid, status, &usage)) {
+            record_child(pid, status, &usage);
+        }
+    }
+}
+
+// Hand a status collected by wait_for_job to whichever job or coprocess
+// owns the pid. wait can run inline in a pipeline whose stages are not
+// in job_list yet, so the pipeline being run is checked too.
+void record_child(pid_t pid, int status, struct rusage* usage) {
+    if (foreground_job != NULL && update_process(foreground_job, pid, status, usage)) {
+        return;
+    }
+    for (Job* job = job_list; job != NULL; job = job->next) {
+        if (update_process(job, pid, status, usage)) {
+            return;
+        }
+    }
+    for (Worker* worker = worker_list; worker != NULL; worker = worker->next) {
+        if (worker->pid == pid && !worker->exited && !WIFSTOPPED(status)) {
+            worker->exited = 1;
+            worker->status = status;
+            return;
+        }
+    }
+}
+
+// Run a job with the terminal until it finishes or stops. With resume set,
+// a stopped job is continued first (fg).
+void run_foreground_job(Job* job, int resume) {
+    // A pipeline made only of builtins has already finished
+    if (!job_is_completed(job)) {
+        if (interactive) {
+            tcsetpgrp(STDIN_FILENO, job->pgid);
+            if (resume && job->has_tmodes) {
+                tcsetattr(STDIN_FILENO, TCSADRAIN, &job->tmodes);
+            }
+        }
+        if (resume) {
+            kill(-job->pgid, SIGCONT);
+        }
+        
+        wait_for_job(job);
+        
+        if (interactive) {
+            tcsetpgrp(STDIN_FILENO, shell_pgid);
+            // Remember the job's terminal modes in case it was stopped mid-edit
+            job->has_tmodes = tcgetattr(STDIN_FILENO, &job->tmodes) == 0;
+            tcsetattr(STDIN_FILENO, TCSADRAIN, &shell_tmodes);
+        }
+        
+        if (job_is_stopped(job)) {
+            if (job->id == 0) {
+                add_job(job);
+            }
+            printf("\n[%d]+  Stopped\t\t%s\n", job->id, job->command);
+            job->notified = 1;
+            last_status = 128 + SIGTSTP;
+            return;
+        }
+    }
+    
+    set_status_from_job(job);
+    if (job->timed) {
+        print_job_times(job);
+    }
+    if (job->num_procs > 1) {
+        report_job_status(job);
+    }
+    finish_job(job);
+}
+
+// Like other shells, a job's status is that of its last stage
+void set_status_from_job(Job* job) {
+    last_status = exit_code(job->procs[job->num_procs - 1].status);
+}
+
+// Shell-style exit code of a wait status: 128 + signal for a killed process
+int exit_code(int status) {
+    if (WIFSIGNALED(status)) {
+        return 128 + WTERMSIG(status);
+    }
+    return WEXITSTATUS(status);
+}
+
+// Record a wait status for one of the job's processes; returns 0 if the
+// pid doesn't belong to this job
+int update_process(Job* job, pid_t pid, int status, struct rusage* usage) {
+    for (int i = 0; i < job->num_procs; i++) {
+        Process* proc = &job->procs[i];
+        if (proc->pid != pid || proc->completed) {
+            continue;
+        }
+        
+        if (WIFSTOPPED(status)) {
+            proc->stopped = 1;
+            job->notified = 0;
+        } else if (WIFCONTINUED(status)) {
+            proc->stopped = 0;
+        } else {
+            proc->status = status;
+            proc->completed = 1;
+            proc->usage = *usage;
+            clock_gettime(CLOCK_MONOTONIC, &proc->finished);
+        }
+        return 1;
+    }
+    return 0;
+}
+
+// Add a stage that runs inside the shell rather than as a child
+Process* add_builtin_process(Job* job, char* name) {
+    Process* proc = &job->procs[job->num_procs++];
+    proc->pid = 0;
+    proc->name = strdup(name);
+    proc->status = 0;
+    proc->completed = 0;
+    proc->stopped = 0;
+    proc->spawn_us = 0;
+    memset(&proc->usage, 0, sizeof(proc->usage));
+    clock_gettime(CLOCK_MONOTONIC, &proc->started);
+    return proc;
+}
+
+void begin_builtin_usage(Process* proc, struct rusage* before) {
+    getrusage(RUSAGE_SELF, before);
+    clock_gettime(CLOCK_MONOTONIC, &proc->started);
+}
+
+// A builtin's usage is what the shell itself consumed while running it
+void end_builtin_usage(Process* proc, struct rusage* before) {
+    struct rusage after;
+    getrusage(RUSAGE_SELF, &after);
+    clock_gettime(CLOCK_MONOTONIC, &proc->finished);
+    
+    timersub(&after.ru_utime, &before->ru_utime, &proc->usage.ru_utime);
+    timersub(&after.ru_stime, &before->ru_stime, &proc->usage.ru_stime);
+    proc->usage.ru_maxrss = after.ru_maxrss;
+    proc->usage.ru_nvcsw = after.ru_nvcsw - before->ru_nvcsw;
+    proc->usage.ru_nivcsw = after.ru_nivcsw - before->ru_nivcsw;
+    
+    proc->status = W_EXITCODE(last_status, 0);
+    proc->completed = 1;
+}
+
+// Log a finished job and release it
+void finish_job(Job* job) {
+    if (stats_file != NULL) {
+        write_job_stats(job);
+    }
+    if (job->id != 0) {
+        remove_job(job);
+    }
+    free_job(job);
+}
+
+long long elapsed_us(struct timespec* from, struct timespec* to) {
+    return (to->tv_sec - from->tv_sec) * 1000000LL + (to->tv_nsec - from->tv_nsec) / 1000;
+}
+
+long long timeval_us(struct timeval* tv) {
+    return tv->tv_sec * 1000000LL + tv->tv_usec;
+}
+
+// Output of the time keyword: totals, then a line per stage for pipelines
+void print_job_times(Job* job) {
+    struct timespec last_finished = job->started;
+    long long user_us = 0, sys_us = 0;
+    
+    for (int i = 0; i < job->num_procs; i++) {
+        Process* proc = &job->procs[i];
+        if (elapsed_us(&last_finished, &proc->finished) > 0) {
+            last_finished = proc->finished;
+        }
+        user_us += timeval_us(&proc->usage.ru_utime);
+        sys_us += timeval_us(&proc->usage.ru_stime);
+    }
+    
+    long long real_us = elapsed_us(&job->started, &last_finished);
+    fprintf(stderr, "\nreal\t%lld.%06llds\n", real_us / 1000000, real_us % 1000000);
+    fprintf(stderr, "user\t%lld.%06llds\n", user_us / 1000000, user_us % 1000000);
+    fprintf(stderr, "sys\t%lld.%06llds\n", sys_us / 1000000, sys_us % 1000000);
+    
+    if (job->num_procs < 2) {
+        return;
+    }
+    for (int i = 0; i < job->num_procs; i++) {
+        Process* proc = &job->procs[i];
+        fprintf(stderr, "  [%d] %-12s spawn %lldus  run %lldus  user %lldus  sys %lldus  "
+                        "maxrss %ldKB  csw %ld/%ld\n",
+                i + 1, proc->name, proc->spawn_us,
+                elapsed_us(&proc->started, &proc->finished) - proc->spawn_us,
+                timeval_us(&proc->usage.ru_utime), timeval_us(&proc->usage.ru_stime),
+                proc->usage.ru_maxrss, proc->usage.ru_nvcsw, proc->usage.ru_nivcsw);
+    }
+}
+
+// One JSON object per line for each finished command
+void write_job_stats(Job* job) {
+    struct timespec last_finished = job->started;
+    for (int i = 0; i < job->num_procs; i++) {
+        if (elapsed_us(&last_finished, &job->procs[i].finished) > 0) {
+            last_finished = job->procs[i].finished;
+        }
+    }
+    
+    fprintf(stats_file, "{\"command\":");
+    write_json_string(stats_file, job->command);
+    fprintf(stats_file, ",\"background\":%s,\"status\":%d,\"wall_us\":%lld,\"stages\":[",
+            job->id != 0 ? "true" : "false", exit_code(job->procs[job->num_procs - 1].status),
+            elapsed_us(&job->started, &last_finished));
+    
+    for (int i = 0; i < job->num_procs; i++) {
+        Process* proc = &job->procs[i];
+        
+        fprintf(stats_file, "%s{\"name\":", i > 0 ? "," : "");
+        write_json_string(stats_file, proc->name);
+        fprintf(stats_file, ",\"pid\":%d,\"builtin\":%s,\"status\":%d,\"spawn_us\":%lld,"
+                            "\"run_us\":%lld,\"user_us\":%lld,\"sys_us\":%lld,\"maxrss_kb\":%ld,"
+                            "\"nvcsw\":%ld,\"nivcsw\":%ld}",
+                (int)proc->pid, proc->pid == 0 ? "true" : "false", exit_code(proc->status),
+                proc->spawn_us,
+                elapsed_us(&proc->started, &proc->finished) - proc->spawn_us,
+                timeval_us(&proc->usage.ru_utime), timeval_us(&proc->usage.ru_stime),
+                proc->usage.ru_maxrss, proc->usage.ru_nvcsw, proc->usage.ru_nivcsw);
+    }
+    fprintf(stats_file, "]}\n");
+    fflush(stats_file);
+}
+
+void write_json_string(FILE* fp, char* text) {
+    fputc('"', fp);
+    for (unsigned char* c = (unsigned char*)text; *c != '\0'; c++) {
+        if (*c == '"' || *c == '\\') {
+            fprintf(fp, "\\%c", *c);
+        } else if (*c < 0x20) {
+            fprintf(fp, "\\u%04x", *c);
+        } else {
+            fputc(*c, fp);
+        }
+    }
+    fputc('"', fp);
+}
+
+// MINISHELL_STATS=<file> appends a JSONL record for every finished command
+void init_stats() {
+    char* path = getenv("MINISHELL_STATS");
+    if (path == NULL || *path == '\0') {
+        return;
+    }
+    
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd == -1 || (stats_file = fdopen(fd, "a")) == NULL) {
+        perror("MINISHELL_STATS");
+        if (fd != -1) {
+            close(fd);
+        }
+    }
+}
+
+int job_is_completed(Job* job) {
+    for (int i = 0; i < job->num_procs; i++) {
+        if (!job->procs[i].completed) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Stopped means every stage that is still around is stopped
+int job_is_stopped(Job* job) {
+    int any_stopped = 0;
+    for (int i = 0; i < job->num_procs; i++) {
+        if (!job->procs[i].completed) {
+            if (!job->procs[i].stopped) {
+                return 0;
+            }
+            any_stopped = 1;
+        }
+    }
+    return any_stopped;
+}
+
+// Only flag the change here; the main loop does the actual reaping
+void sigchld_handler(int sig) {
+    (void)sig;
+    child_status_changed = 1;
+}
+
+// Collect status changes of background jobs and coprocesses without
+// blocking. Only their own pids are waited for: jobs, wait and coproc
+// can run inline in a foreground pipeline whose stages are not listed
+// yet, and reaping one of those here would lose its status.
+void reap_background_jobs() {
+    if (!child_status_changed) {
+        return;
+    }
+    child_status_changed = 0;
+    
+    int status;
+    struct rusage usage;
+    for (Job* job = job_list; job != NULL; job = job->next) {
+        for (int i = 0; i < job->num_procs; i++) {
+            pid_t pid = job->procs[i].pid;
+            while (pid > 0 && !job->procs[i].completed &&
+                   wait4(pid, &status, WNOHANG | WUNTRACED | WCONTINUED, &usage) > 0) {
+                update_process(job, pid, status, &usage);
+            }
+        }
+    }
+    
+    // A coprocess may also have died on its own
+    for (Worker* worker = worker_list; worker != NULL; worker = worker->next) {
+        if (!worker->exited && waitpid(worker->pid, &status, WNOHANG) > 0) {
+            worker->exited = 1;
+            worker->status = status;
+        }
+    }
+}
+
+// Report finished and newly stopped background jobs, then drop the
+// finished ones from the table. Scripts keep them so wait can still
+// collect their status.
+void notify_jobs() {
+    Job* job = job_list;
+    while (job != NULL) {
+        Job* next = job->next;
+        
+        if (job_is_completed(job) && interactive) {
+            int status = job->procs[job->num_procs - 1].status;
+            if (WIFEXITED(status) && WEXITSTATUS(status) != 0) {
+                printf("[%d]   Exit %d\t\t%s\n", job->id, WEXITSTATUS(status), job->command);
+            } else {
+                printf("[%d]   Done\t\t%s\n", job->id, job->command);
+            }
+            finish_job(job);
+        } else if (job_is_stopped(job) && !job->notified) {
+            if (interactive) {
+                printf("[%d]+  Stopped\t\t%s\n", job->id, job->command);
+            }
+            job->notified = 1;
+        }
+        
+        job = next;
+    }
+}
+
+// Take control of the terminal and install the signal dispositions
+void init_job_control() {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = sigchld_handler;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGCHLD, &sa, NULL);
+    
+    shell_pgid = getpgrp();
+    if (!interactive) {
+        return;
+    }
+    
+    // Wait until we are in the foreground before touching the terminal
+    while (tcgetpgrp(STDIN_FILENO) != (shell_pgid = getpgrp())) {
+        kill(-shell_pgid, SIGTTIN);
+    }
+    
+    // Ignore Ctrl+C, Ctrl+Z and friends; they are meant for the jobs
+    for (size_t i = 0; i < sizeof(job_control_signals) / sizeof(int); i++) {
+        signal(job_control_signals[i], SIG_IGN);
+    }
+    
+    // Lead our own process group and own the terminal
+    shell_pgid = getpid();
+    if (setpgid(shell_pgid, shell_pgid) == -1 && errno != EPERM) {
+        perror("setpgid");
+    }
+    shell_pgid = getpgrp();
+    tcsetpgrp(STDIN_FILENO, shell_pgid);
+    tcgetattr(STDIN_FILENO, &shell_tmodes);
+}
+
+// Undo the shell's signal dispositions in a forked child
+void reset_child_signals() {
+    for (size_t i = 0; i < sizeof(job_control_signals) / sizeof(int); i++) {
+        signal(job_control_signals[i], SIG_DFL);
+    }
+    signal(SIGCHLD, SIG_DFL);
+}
+
+// Print the outcome of every stage that did not exit cleanly
+void report_job_status(Job* job) {
+    for (int i = 0; i < job->num_procs; i++) {
+        Process* proc = &job->procs[i];
+        if (!proc->completed) {
+            continue;
+        }
+        
+        // SIGPIPE is the normal way for an upstream stage to stop early
+        if (WIFSIGNALED(proc->status) && WTERMSIG(proc->status) != SIGPIPE) {
+            fprintf(stderr, "[stage %d] %s: terminated by signal %d\n",
+                    i + 1, proc->name, WTERMSIG(proc->status));
+        } else if (WIFEXITED(proc->status) && WEXITSTATUS(proc->status) != 0) {
+            fprintf(stderr, "[stage %d] %s: exited with status %d\n",
+                    i + 1, proc->name, WEXITSTATUS(proc->status));
+        }
+    }
+}
+
+Job* create_job(Pipeline* pipeline) {
+    Job* job = malloc(sizeof(Job));
+    if (job) {
+        job->procs = malloc(pipeline->num_commands * sizeof(Process));
+        job->command = strdup(pipeline->source);
+    }
+    if (!job || !job->procs || !job->command) {
+        fprintf(stderr, "Memory allocation error\n");
+        exit(1);
+    }
+    
+    job->id = 0;
+    job->pgid = 0;
+    job->num_procs = 0;
+    job->timed = pipeline->timed;
+    clock_gettime(CLOCK_MONOTONIC, &job->started);
+    job->notified = 0;
+    job->has_tmodes = 0;
+    job->next = NULL;
+    return job;
+}
+
+void free_job(Job* job) {
+    for (int i = 0; i < job->num_procs; i++) {
+        free(job->procs[i].name);
+    }
+    free(job->procs);
+    free(job->command);
+    free(job);
+}
+
+// Append to the job table with the next free job number
+void add_job(Job* job) {
+    Job** link = &job_list;
+    int id = 1;
+    while (*link != NULL) {
+        id = (*link)->id + 1;
+        link = &(*link)->next;
+    }
+    job->id = id;
+    job->next = NULL;
+    *link = job;
+}
+
+void remove_job(Job* job) {
+    for (Job** link = &job_list; *link != NULL; link = &(*link)->next) {
+        if (*link == job) {
+            *link = job->next;
+            job->next = NULL;
+            return;
+        }
+    }
+}
+
+// Look up %n, n, %+ / %% or a pid; NULL means the most recent job
+Job* find_job(char* spec) {
+    Job* last = job_list;
+    while (last != NULL && last->next != NULL) {
+        last = last->next;
+    }
+    
+    if (spec == NULL || strcmp(spec, "%+") == 0 || strcmp(spec, "%%") == 0) {
+        return last;
+    }
+    
+    if (spec[0] == '%') {
+        int id = atoi(spec + 1);
+        for (Job* job = job_list; job != NULL; job = job->next) {
+            if (job->id == id) {
+                return job;
+            }
+        }
+        return NULL;
+    }
+    
+    // A bare number is a pid, as for wait
+    pid_t pid = atoi(spec);
+    for (Job* job = job_list; job != NULL; job = job->next) {
+        for (int i = 0; i < job->num_procs; i++) {
+            if (job->procs[i].pid == pid) {
+                return job;
+            }
+        }
+    }
+    return NULL;
+}
+
+// Start one stage of a job and record it; returns -1 if it could not start
+int launch_process(Job* job, SpawnRequest* req) {
+    // Don't let children inherit unflushed shell output
+    fflush(stdout);
+    
+    struct timespec started, spawned;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    
+    req->pgid = job->pgid;
+    pid_t pid = spawn_command(req);
+    if (pid == -1) {
+        last_status = 127;
+        return -1;
+    }
+    
+    clock_gettime(CLOCK_MONOTONIC, &spawned);
+    
+    // First stage leads the process group; set it from the parent too so
+    // the group exists before we hand it the terminal
+    if (interactive) {
+        if (job->pgid == 0) {
+            job->pgid = pid;
+        }
+        setpgid(pid, job->pgid);
+    }
+    
+    Process* proc = &job->procs[job->num_procs++];
+    proc->pid = pid;
+    proc->name = strdup(req->args[0]);
+    proc->status = 0;
+    proc->completed = 0;
+    proc->stopped = 0;
+    proc->started = started;
+    proc->spawn_us = elapsed_us(&started, &spawned);
+    memset(&proc->usage, 0, sizeof(proc->usage));
+    return 0;
+}
+
+// Start a command with the selected backend. Builtins can only run in a
+// forked copy of the shell, so they always take the fork path.
+pid_t spawn_command(SpawnRequest* req) {
+    if (is_builtin(req->args[0])) {
+        req->path = NULL;
+        return spawn_fork(req);
+    }
+    
+    int from_cache;
+    req->path = resolve_command(req->args[0], &from_cache);
+    if (req->path == NULL) {
+        fprintf(stderr, "Command execution failed: %s: command not found\n", req->args[0]);
+        return -1;
+    }
+    
+    if (spawn_backend == SPAWN_FORK) {
+        // A forked child can't update our cache, so check staleness here
+        if (from_cache && access(req->path, X_OK) != 0) {
+            forget_command(req->args[0]);
+            req->path = resolve_command(req->args[0], &from_cache);
+            if (req->path == NULL) {
+                fprintf(stderr, "Command execution failed: %s: command not found\n", req->args[0]);
+                return -1;
+            }
+        }
+        return spawn_fork(req);
+    }
+    
+    pid_t pid = spawn_posix(req);
+    if (pid == -1 && from_cache && errno == ENOENT) {
+        // The cached binary moved or vanished; search PATH again once
+        forget_command(req->args[0]);
+        req->path = resolve_command(req->args[0], &from_cache);
+        if (req->path != NULL) {
+            pid = spawn_posix(req);
+        }
+    }
+    
+    if (pid == -1 && errno != 0) {
+        fprintf(stderr, "Command execution failed: %s: %s\n", req->args[0], strerror(errno));
+    }
+    return pid;
+}
+
+// posix_spawn starts the child without copying the shell's page tables
+// (glibc uses clone(CLONE_VM | CLONE_VFORK)), so the cost doesn't grow
+// with the shell's resident set
+pid_t spawn_posix(SpawnRequest* req) {
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    sigset_t default_signals, empty_mask;
+    pid_t pid;
+    
+    posix_spawn_file_actions_init(&actions);
+    for (int i = 0; i < req->num_actions; i++) {
+        FdAction* action = &req->actions[i];
+        if (action->source_fd == -1) {
+            posix_spawn_file_actions_addclose(&actions, action->fd);
+        } else {
+            posix_spawn_file_actions_adddup2(&actions, action->source_fd, action->fd);
+        }
+    }
+    
+    sigemptyset(&default_signals);
+    for (size_t i = 0; i < sizeof(job_control_signals) / sizeof(int); i++) {
+        sigaddset(&default_signals, job_control_signals[i]);
+    }
+    sigemptyset(&empty_mask);
+    
+    posix_spawnattr_init(&attr);
+    short flags = POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK;
+    if (interactive) {
+        flags |= POSIX_SPAWN_SETPGROUP;
+    }
+    posix_spawnattr_setflags(&attr, flags);
+    posix_spawnattr_setpgroup(&attr, req->pgid);
+    posix_spawnattr_setsigdefault(&attr, &default_signals);
+    posix_spawnattr_setsigmask(&attr, &empty_mask);
     
-    // Ignore SIGINT (Ctrl+C) for the shell process
-    signal(SIGINT, SIG_IGN);
+    int err = posix_spawn(&pid, req->path, &actions, &attr, req->args, environ);
     
-    shell_loop();
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
     
-    return 0;
+    if (err == ENOSYS) {
+        // No usable posix_spawn here; stay on fork from now on
+        spawn_backend = SPAWN_FORK;
+        return spawn_fork(req);
+    }
+    if (err != 0) {
+        // Leave reporting to the caller, which may retry a stale path
+        errno = err;
+        return -1;
+    }
+    return pid;
 }
 
-void shell_loop() {
-    char* input;
-    char** args;
-    int status = 1;
+pid_t spawn_fork(SpawnRequest* req) {
+    pid_t pid = fork();
     
-    do {
-        printf("minishell> ");
-        input = read_input();
+    if (pid == 0) {
+        // Child process
+        if (interactive) {
+            setpgid(0, req->pgid);
+        }
+        reset_child_signals();
         
-        // Check for pipes first
-        if (strchr(input, '|') != NULL) {
-            handle_pipes(input);
-        } else {
-            args = parse_input(input);
-            if (args[0] != NULL) {
-                status = execute_command(args);
+        for (int i = 0; i < req->num_actions; i++) {
+            FdAction* action = &req->actions[i];
+            if (action->source_fd == -1) {
+                close(action->fd);
+            } else if (dup2(action->source_fd, action->fd) == -1) {
+                perror("Redirection failed");
+                exit(1);
             }
-            free(args);
         }
         
-        free(input);
-    } while (status);
+        if (req->path == NULL) {
+            close_exec_fds();
+            in_pipeline_stage = 1;
+        }
+        int builtin_result = execute_builtin(req->args);
+        if (builtin_result != -1) {
+            fflush(stdout);
+            exit(last_status);
+        }
+        
+        execve(req->path, req->args, environ);
+        if (errno == ENOENT) {
+            // Cached path went stale; fall back to a full PATH search
+            execvp(req->args[0], req->args);
+        }
+        perror("Command execution failed");
+        exit(127);
+    } else if (pid < 0) {
+        perror("Fork failed");
+        errno = 0;
+        return -1;
+    }
+    return pid;
+}
+
+// A forked builtin never execs, so close-on-exec never fires and it would
+// hold on to pipe ends meant for other stages (echo hi | coproc -s w never
+// saw EOF). Close them as exec would, keeping the coprocess pipes.
+void close_exec_fds() {
+    DIR* dir = opendir("/proc/self/fd");
+    if (dir == NULL) {
+        return;
+    }
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+        int fd = atoi(entry->d_name);
+        int flags = fcntl(fd, F_GETFD);
+        if (fd <= STDERR_FILENO || fd == dirfd(dir) || flags == -1 || !(flags & FD_CLOEXEC)) {
+            continue;
+        }
+        int keep = 0;
+        for (Worker* worker = worker_list; worker != NULL; worker = worker->next) {
+            keep |= fd == worker->to_fd || fd == worker->from_fd;
+        }
+        if (!keep) {
+            close(fd);
+        }
+    }
+    closedir(dir);
+}
+
+unsigned int hash_name(char* name) {
+    unsigned int hash = 5381;
+    for (char* c = name; *c != '\0'; c++) {
+        hash = hash * 33 + (unsigned char)*c;
+    }
+    return hash % HASH_BUCKETS;
 }
 
-char* read_input() {
-    char* input = malloc(MAX_INPUT);
-    if (!input) {
+// Map a command name to the executable to run. Names containing a slash
+// are used as-is; everything else is looked up once per $PATH value.
+char* resolve_command(char* name, int* from_cache) {
+    *from_cache = 0;
+    if (strchr(name, '/') != NULL) {
+        return name;
+    }
+    
+    // Changing PATH invalidates every cached entry
+    char* path_env = getenv("PATH");
+    if (path_env == NULL) {
+        path_env = "";
+    }
+    if (hashed_path_env == NULL || strcmp(hashed_path_env, path_env) != 0) {
+        clear_command_hash();
+        hashed_path_env = strdup(path_env);
+    }
+    
+    unsigned int bucket = hash_name(name);
+    for (HashEntry* entry = command_hash[bucket]; entry != NULL; entry = entry->next) {
+        if (strcmp(entry->name, name) == 0) {
+            entry->hits++;
+            hash_hits++;
+            *from_cache = 1;
+            return entry->path;
+        }
+    }
+    
+    hash_misses++;
+    char* path = search_path(name);
+    if (path == NULL) {
+        return NULL;
+    }
+    
+    HashEntry* entry = malloc(sizeof(HashEntry));
+    if (!entry) {
         fprintf(stderr, "Memory allocation error\n");
         exit(1);
     }
+    entry->name = strdup(name);
+    entry->path = path;
+    entry->hits = 0;
+    entry->next = command_hash[bucket];
+    command_hash[bucket] = entry;
+    return path;
+}
+
+// Walk $PATH for an executable regular file; returns a malloc'd path
+char* search_path(char* name) {
+    char* path_env = getenv("PATH");
+    if (path_env == NULL) {
+        return NULL;
+    }
     
-    if (fgets(input, MAX_INPUT, stdin) == NULL) {
-        if (feof(stdin)) {
-            printf("\nGoodbye!\n");
-            exit(0);
-        } else {
-            perror("read_input");
+    size_t name_len = strlen(name);
+    char* dir = path_env;
+    while (1) {
+        char* end = strchrnul(dir, ':');
+        size_t dir_len = end - dir;
+        
+        // An empty PATH element means the current directory
+        char* candidate = malloc(dir_len + name_len + 3);
+        if (!candidate) {
+            fprintf(stderr, "Memory allocation error\n");
             exit(1);
         }
+        if (dir_len == 0) {
+            strcpy(candidate, "./");
+        } else {
+            memcpy(candidate, dir, dir_len);
+            candidate[dir_len] = '/';
+            candidate[dir_len + 1] = '\0';
+        }
+        strcat(candidate, name);
+        
+        struct stat st;
+        if (stat(candidate, &st) == 0 && S_ISREG(st.st_mode) && access(candidate, X_OK) == 0) {
+            return candidate;
+        }
+        free(candidate);
+        
+        if (*end == '\0') {
+            break;
+        }
+        dir = end + 1;
     }
-    
-    // Remove newline character
-    input[strcspn(input, "\n")] = '\0';
-    
-    return input;
+    return NULL;
+}
+
+void forget_command(char* name) {
+    HashEntry** link = &command_hash[hash_name(name)];
+    while (*link != NULL) {
+        HashEntry* entry = *link;
+        if (strcmp(entry->name, name) == 0) {
+            *link = entry->next;
+            free(entry->name);
+            free(entry->path);
+            free(entry);
+            return;
+        }
+        link = &entry->next;
+    }
+}
+
+void clear_command_hash() {
+    for (int i = 0; i < HASH_BUCKETS; i++) {
+        HashEntry* entry = command_hash[i];
+        while (entry != NULL) {
+            HashEntry* next = entry->next;
+            free(entry->name);
+            free(entry->path);
+            free(entry);
+            entry = next;
+        }
+        command_hash[i] = NULL;
+    }
+    free(hashed_path_env);
+    hashed_path_env = NULL;
+}
+
+Worker* find_worker(char* name) {
+    for (Worker* worker = worker_list; worker != NULL; worker = worker->next) {
+        if (strcmp(worker->name, name) == 0) {
+            return worker;
+        }
+    }
+    return NULL;
 }
 
-char** parse_input(char* input) {
-    int position = 0;
-    char** tokens = malloc(MAX_ARGS * sizeof(char*));
-    char* token;
+// Start the worker's command with its stdin and stdout connected to us
+int launch_worker(Worker* worker) {
+    int to_pipe[2], from_pipe[2];
+    if (pipe2(to_pipe, O_CLOEXEC) == -1) {
+        perror("coproc: pipe");
+        return -1;
+    }
+    if (pipe2(from_pipe, O_CLOEXEC) == -1) {
+        perror("coproc: pipe");
+        close(to_pipe[0]);
+        close(to_pipe[1]);
+        return -1;
+    }
     
-    if (!tokens) {
-        fprintf(stderr, "Memory allocation error\n");
-        exit(1);
+    FdAction actions[2] = {
+        { STDIN_FILENO, to_pipe[0], 1 },
+        { STDOUT_FILENO, from_pipe[1], 1 }
+    };
+    SpawnRequest req = { worker->argv, NULL, actions, 2, 0 };
+    
+    fflush(stdout);
+    pid_t pid = spawn_command(&req);
+    close_owned_fds(&req);
+    if (pid == -1) {
+        close(to_pipe[1]);
+        close(from_pipe[0]);
+        return -1;
     }
     
-    token = strtok(input, " \t\r\n\a");
-    while (token != NULL && position < MAX_ARGS - 1) {
-        tokens[position] = token;
-        position++;
-        token = strtok(NULL, " \t\r\n\a");
+    // Its own process group keeps terminal signals meant for
+    // foreground jobs away from it
+    if (interactive) {
+        setpgid(pid, pid);
     }
-    tokens[position] = NULL;
     
-    return tokens;
+    worker->pid = pid;
+    worker->to_fd = to_pipe[1];
+    worker->from_fd = from_pipe[0];
+    init_reader_fd(&worker->reader, worker->from_fd);
+    worker->reader.timeout_ms = COPROC_TIMEOUT_MS;
+    worker->exited = 0;
+    worker->status = 0;
+    return 0;
 }
 
-int execute_command(char** args) {
-    if (args[0] == NULL) {
-        return 1; // Empty command
+// Register a new coprocess running args
+Worker* start_worker(char* name, char** args, int line_mode) {
+    Worker* worker = malloc(sizeof(Worker));
+    if (!worker) {
+        fprintf(stderr, "Memory allocation error\n");
+        exit(1);
     }
     
-    // Check if it's a built-in command
-    int builtin_result = execute_builtin(args);
-    if (builtin_result != -1) {
-        return builtin_result;
+    int argc = 0;
+    size_t len = 0;
+    for (; args[argc] != NULL; argc++) {
+        len += strlen(args[argc]) + 1;
     }
-    
-    // Check for redirection operators
-    int has_redirection = 0;
-    for (int i = 0; args[i] != NULL; i++) {
-        if (strcmp(args[i], "<") == 0 || strcmp(args[i], ">") == 0) {
-            has_redirection = 1;
-            break;
+    worker->command = malloc(len + 1);
+    worker->argv = malloc((argc + 1) * sizeof(char*));
+    if (!worker->command || !worker->argv) {
+        fprintf(stderr, "Memory allocation error\n");
+        exit(1);
+    }
+    worker->command[0] = '\0';
+    for (int i = 0; i < argc; i++) {
+        if (i > 0) {
+            strcat(worker->command, " ");
         }
+        strcat(worker->command, args[i]);
+        worker->argv[i] = strdup(args[i]);
     }
+    worker->argv[argc] = NULL;
+    worker->name = strdup(name);
+    worker->line_mode = line_mode;
+    worker->requests = 0;
     
-    if (has_redirection) {
-        handle_redirection(args);
-    } else {
-        execute_single_command(args);
+    if (launch_worker(worker) == -1) {
+        for (int i = 0; i < argc; i++) {
+            free(worker->argv[i]);
+        }
+        free(worker->argv);
+        free(worker->command);
+        free(worker->name);
+        free(worker);
+        return NULL;
     }
     
-    return 1;
-}
-
-int execute_builtin(char** args) {
-    for (int i = 0; i < num_builtins(); i++) {
-        if (strcmp(args[0], builtin_commands[i]) == 0) {
-            return (*builtin_functions[i])(args);
-        }
+    Worker** tail = &worker_list;
+    while (*tail != NULL) {
+        tail = &(*tail)->next;
     }
-    return -1; // Not a built-in command
+    worker->next = NULL;
+    *tail = worker;
+    return worker;
 }
 
-void handle_redirection(char** args) {
-    int input_redirect = -1, output_redirect = -1;
-    char* input_file = NULL;
-    char* output_file = NULL;
-    int arg_count = 0;
-    
-    // Count arguments and find redirection operators
-    while (args[arg_count] != NULL) {
-        if (strcmp(args[arg_count], "<") == 0) {
-            input_redirect = arg_count;
-            input_file = args[arg_count + 1];
-            args[arg_count] = NULL; // Remove redirection from args
-        } else if (strcmp(args[arg_count], ">") == 0) {
-            output_redirect = arg_count;
-            output_file = args[arg_count + 1];
-            args[arg_count] = NULL; // Remove redirection from args
-        }
-        arg_count++;
+// A worker that missed a reply may still send it later, where it would be
+// taken as the answer to the next request. Replace it with a fresh copy.
+void restart_worker(Worker* worker) {
+    close(worker->to_fd);
+    close(worker->from_fd);
+    if (!worker->exited) {
+        kill(worker->pid, SIGTERM);
+        waitpid(worker->pid, &worker->status, 0);
     }
+    free(worker->reader.buf);
+    free(worker->reader.line);
     
-    pid_t pid = fork();
+    if (launch_worker(worker) == -1) {
+        // Keep the closed ends out of reach of stop_worker's close
+        init_reader_fd(&worker->reader, -1);
+        worker->to_fd = -1;
+        worker->from_fd = -1;
+        worker->exited = 1;
+        fprintf(stderr, "coproc: %s: could not restart the worker\n", worker->name);
+        return;
+    }
+    fprintf(stderr, "coproc: %s: worker restarted\n", worker->name);
+}
+
+// Closing its stdin is the polite way to stop a filter; one that hangs on
+// gets SIGTERM. Either way it is reaped here, not by the job code.
+void stop_worker(Worker* worker) {
+    close(worker->to_fd);
+    close(worker->from_fd);
     
-    if (pid == 0) {
-        // Child process - handle redirection here
-        
-        // Handle input redirection
-        if (input_redirect != -1 && input_file != NULL) {
-            int fd_in = open(input_file, O_RDONLY);
-            if (fd_in == -1) {
-                perror("Input redirection failed");
-                exit(1);
+    if (!worker->exited) {
+        int status;
+        pid_t pid = 0;
+        for (int i = 0; i < 50 && pid == 0; i++) {
+            pid = waitpid(worker->pid, &status, WNOHANG);
+            if (pid == 0) {
+                usleep(2000);
             }
-            dup2(fd_in, STDIN_FILENO);
-            close(fd_in);
         }
-        
-        // Handle output redirection
-        if (output_redirect != -1 && output_file != NULL) {
-            int fd_out = open(output_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-            if (fd_out == -1) {
-                perror("Output redirection failed");
-                exit(1);
-            }
-            dup2(fd_out, STDOUT_FILENO);
-            close(fd_out);
+        if (pid == 0) {
+            kill(worker->pid, SIGTERM);
+            waitpid(worker->pid, &status, 0);
         }
-        
-        // Execute the command
-        if (execvp(args[0], args) == -1) {
-            perror("Command execution failed");
+    }
+    
+    for (Worker** link = &worker_list; *link != NULL; link = &(*link)->next) {
+        if (*link == worker) {
+            *link = worker->next;
+            break;
         }
-        exit(1);
-    } else if (pid > 0) {
-        // Parent process - wait for child
-        int status;
-        waitpid(pid, &status, 0);
-    } else {
-        perror("Fork failed");
     }
+    free(worker->reader.buf);
+    free(worker->reader.line);
+    for (int i = 0; worker->argv[i] != NULL; i++) {
+        free(worker->argv[i]);
+    }
+    free(worker->argv);
+    free(worker->name);
+    free(worker->command);
+    free(worker);
 }
 
-void handle_pipes(char* input) {
-    char* commands[MAX_COMMANDS];
-    int num_commands = 0;
+// Send one request to a worker and copy its reply to stdout.
+//
+// Frame mode, both directions: "<length>\n" followed by exactly that many
+// bytes. The length is decimal and the payload may hold anything,
+// newlines included, so one request can carry a whole input file.
+//
+// Line mode (coproc -l) is for filters that answer every input line with
+// exactly one output line and flush it straight away: cat, sed -u, tr
+// under stdbuf -oL, awk with fflush(). Filters that can stay silent
+// (grep) or only answer at EOF (wc, sort) never finish a request; after
+// the timeout the worker is restarted, so a late reply can't be read as
+// the answer to the next request. The same goes for a frame-mode worker
+// that stops mid-reply or sends a bad header.
+int worker_request(Worker* worker, char* payload, size_t len) {
+    if (worker->exited) {
+        fprintf(stderr, "coproc: %s: worker has exited\n", worker->name);
+        return -1;
+    }
+    
+    // A worker that died since we last looked must not kill us
+    struct sigaction ignore_pipe, saved_pipe;
+    memset(&ignore_pipe, 0, sizeof(ignore_pipe));
+    ignore_pipe.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &ignore_pipe, &saved_pipe);
     
-    // Split input by pipes
-    char* token = strtok(input, "|");
-    while (token != NULL && num_commands < MAX_COMMANDS) {
-        commands[num_commands] = token;
-        num_commands++;
-        token = strtok(NULL, "|");
+    int result = 0;
+    if (!worker->line_mode) {
+        char header[32];
+        int header_len = snprintf(header, sizeof(header), "%zu\n", len);
+        result = write_all(worker->to_fd, header, header_len);
     }
+    if (result == 0) {
+        result = write_all(worker->to_fd, payload, len);
+    }
+    sigaction(SIGPIPE, &saved_pipe, NULL);
     
-    int pipe_fds[2];
-    int input_fd = 0;
+    if (result == -1) {
+        fprintf(stderr, "coproc: %s: %s\n", worker->name, strerror(errno));
+        return -1;
+    }
+    worker->requests++;
     
-    for (int i = 0; i < num_commands; i++) {
-        char** args = parse_input(commands[i]);
-        
-        if (i < num_commands - 1) {
-            // Create pipe for all but the last command
-            if (pipe(pipe_fds) == -1) {
-                perror("Pipe creation failed");
-                return;
+    InputReader* reader = &worker->reader;
+    reader->timed_out = 0;
+    
+    if (worker->line_mode) {
+        size_t lines = 0;
+        for (size_t i = 0; i < len; i++) {
+            if (payload[i] == '\n') {
+                lines++;
             }
         }
-        
-        pid_t pid = fork();
-        if (pid == 0) {
-            // Child process
-            if (input_fd != 0) {
-                dup2(input_fd, STDIN_FILENO);
-                close(input_fd);
+        for (size_t i = 0; i < lines; i++) {
+            char* line = read_input(reader);
+            if (line == NULL || reader->timed_out) {
+                break;
             }
-            
-            if (i < num_commands - 1) {
-                dup2(pipe_fds[1], STDOUT_FILENO);
-                close(pipe_fds[1]);
-                close(pipe_fds[0]);
+            printf("%s\n", line);
+        }
+    } else {
+        char* header = read_input(reader);
+        char* end = NULL;
+        unsigned long long reply_len = 0;
+        if (header != NULL && !reader->timed_out) {
+            reply_len = strtoull(header, &end, 10);
+        }
+        if (end == NULL || end == header || *end != '\0') {
+            if (header != NULL && !reader->timed_out) {
+                fprintf(stderr, "coproc: %s: bad reply header\n", worker->name);
+                restart_worker(worker);
+                return -1;
             }
-            
-            if (execute_builtin(args) == -1) {
-                execvp(args[0], args);
-                perror("Command execution failed");
-                exit(1);
+        } else {
+            // Stream the payload straight out of the reader's buffer
+            fflush(stdout);
+            while (reply_len > 0) {
+                if (reader->start == reader->end && fill_reader(reader) == 0) {
+                    break;
+                }
+                size_t take = reader->end - reader->start;
+                if (take > reply_len) {
+                    take = reply_len;
+                }
+                if (write_all(STDOUT_FILENO, reader->buf + reader->start, take) == -1) {
+                    reader->start += take;
+                    reply_len -= take;
+                    break;
+                }
+                reader->start += take;
+                reply_len -= take;
             }
-            exit(0);
-        } else if (pid > 0) {
-            // Parent process
-            if (input_fd != 0) {
-                close(input_fd);
+            if (reply_len == 0) {
+                return 0;
             }
-            
-            if (i < num_commands - 1) {
-                close(pipe_fds[1]);
-                input_fd = pipe_fds[0];
+        }
+    }
+    
+    if (reader->timed_out) {
+        fprintf(stderr, "coproc: %s: no reply after %d ms\n", worker->name, COPROC_TIMEOUT_MS);
+        restart_worker(worker);
+        return -1;
+    }
+    if (reader->eof) {
+        fprintf(stderr, "coproc: %s: worker closed its output\n", worker->name);
+        return -1;
+    }
+    return 0;
+}
+
+int write_all(int fd, char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
             }
-            
-            wait(NULL);
-        } else {
-            perror("Fork failed");
+            return -1;
         }
-        
-        free(args);
+        data += n;
+        len -= n;
     }
+    return 0;
 }
 
-void execute_single_command(char** args) {
-    pid_t pid = fork();
+// coproc -s NAME without text reads its request from stdin, so in a
+// pipeline it needs its own process to read the pipe
+int builtin_reads_stdin(char** args) {
+    return strcmp(args[0], "coproc") == 0 && args[1] != NULL &&
+           strcmp(args[1], "-s") == 0 && args[2] != NULL && args[3] == NULL;
+}
+
+// MINISHELL_SPAWN=fork forces the fork backend; anything else uses posix_spawn.
+// MINISHELL_PIPE_BUILTINS=fork runs builtins in pipelines in a forked child.
+void select_spawn_backend() {
+    char* backend = getenv("MINISHELL_SPAWN");
     
-    if (pid == 0) {
-        // Child process
-        if (execvp(args[0], args) == -1) {
-            perror("Command execution failed");
-        }
-        exit(1);
-    } else if (pid > 0) {
-        // Parent process
-        int status;
-        waitpid(pid, &status, 0);
+    if (backend != NULL && strcmp(backend, "fork") == 0) {
+        spawn_backend = SPAWN_FORK;
     } else {
-        perror("Fork failed");
+        spawn_backend = SPAWN_POSIX;
+    }
+    
+    char* pipe_builtins = getenv("MINISHELL_PIPE_BUILTINS");
+    inline_pipe_builtins = pipe_builtins == NULL || strcmp(pipe_builtins, "fork") != 0;
+}
+
+// MINISHELL_BALLAST_MB=N makes the shell allocate and touch N MB, so the
+// spawn benchmark can show how fork's cost grows with a large shell
+void init_ballast() {
+    char* mb = getenv("MINISHELL_BALLAST_MB");
+    size_t size = mb != NULL ? strtoul(mb, NULL, 10) << 20 : 0;
+    if (size == 0) {
+        return;
+    }
+    
+    ballast = malloc(size);
+    if (ballast == NULL) {
+        fprintf(stderr, "MINISHELL_BALLAST_MB: can't allocate %s MB\n", mb);
+        return;
     }
+    memset(ballast, 1, size);
 }
 
 // Built-in command implementations
@@ -317,10 +2467,12 @@ int shell_cd(char** args) {
         // No argument, go to home directory
         if (chdir(getenv("HOME")) != 0) {
             perror("cd");
+            last_status = 1;
         }
     } else {
         if (chdir(args[1]) != 0) {
             perror("cd");
+            last_status = 1;
         }
     }
     return 1;
@@ -348,7 +2500,13 @@ int shell_echo(char** args) {
 }
 
 int shell_exit(char** args) {
-    printf("Goodbye!\n");
+    if (args[1] != NULL) {
+        last_status = atoi(args[1]);
+    }
+    // As a pipeline stage it only sets that stage's status
+    if (interactive && !in_pipeline_stage) {
+        printf("Goodbye!\n");
+    }
     return 0;
 }
 
@@ -358,19 +2516,290 @@ int shell_help(char** args) {
     printf("  cd [directory]    - Change directory\n");
     printf("  pwd              - Print working directory\n");
     printf("  echo [text]      - Print text\n");
-    printf("  exit             - Exit the shell\n");
+    printf("  exit [status]    - Exit the shell\n");
     printf("  help             - Show this help\n");
+    printf("  hash [-r] [name] - Show, clear or prime the command path cache\n");
+    printf("  jobs             - List background and stopped jobs\n");
+    printf("  fg [%%n]          - Continue a job in the foreground\n");
+    printf("  bg [%%n]          - Continue a stopped job in the background\n");
+    printf("  wait [%%n|pid]    - Wait for background jobs to finish\n");
+    printf("  coproc [-l] NAME command - Start a persistent worker\n");
+    printf("                             (-l: filters giving one line per line)\n");
+    printf("  coproc -s NAME [text]    - Send text (or piped stdin) to a worker\n");
+    printf("  coproc [-k NAME]  - List workers, or stop one\n");
+    printf("  time pipeline    - Report wall, user and sys time of a pipeline\n");
     printf("\nSupported features:\n");
     printf("  - External commands (ls, cat, touch, etc.)\n");
     printf("  - Input redirection: command < file\n");
-    printf("  - Output redirection: command > file\n");
+    printf("  - Output redirection: command > file, >> file, 2> file, 2>&1\n");
+    printf("  - Heredocs and here-strings: command << EOF, command <<< text\n");
     printf("  - Piping: command1 | command2\n");
+    printf("  - Background jobs: command &\n");
+    printf("  - Per-command stats: MINISHELL_STATS=file.jsonl minishell\n");
+    printf("  - Quoting: 'single', \"double\" and \\ escapes\n");
+    printf("  - Scripts: minishell script.sh, minishell -c 'commands'\n");
     printf("\nExamples:\n");
     printf("  ls -la\n");
     printf("  cat file.txt\n");
     printf("  echo 'Hello World' > output.txt\n");
     printf("  cat < input.txt\n");
+    printf("  grep x < big.log | sort > out 2>&1\n");
     printf("  ls | grep txt\n");
     printf("  ps aux | grep bash | wc -l\n");
     return 1;
 }
+
+int shell_hash(char** args) {
+    if (args[1] != NULL && strcmp(args[1], "-r") == 0) {
+        clear_command_hash();
+        // The hit rate describes the table as it is now
+        hash_hits = 0;
+        hash_misses = 0;
+        return 1;
+    }
+    
+    // hash name... resolves and caches the given commands
+    if (args[1] != NULL) {
+        for (int i = 1; args[i] != NULL; i++) {
+            int from_cache;
+            if (resolve_command(args[i], &from_cache) == NULL) {
+                fprintf(stderr, "hash: %s: not found\n", args[i]);
+            }
+        }
+        return 1;
+    }
+    
+    printf("hits\tcommand\n");
+    for (int i = 0; i < HASH_BUCKETS; i++) {
+        for (HashEntry* entry = command_hash[i]; entry != NULL; entry = entry->next) {
+            printf("%4d\t%s\n", entry->hits, entry->path);
+        }
+    }
+    printf("cache hits: %lu, misses: %lu\n", hash_hits, hash_misses);
+    return 1;
+}
+
+int shell_jobs(char** args) {
+    (void)args;
+    reap_background_jobs();
+    
+    for (Job* job = job_list; job != NULL; job = job->next) {
+        char* state = "Running";
+        if (job_is_completed(job)) {
+            state = "Done";
+        } else if (job_is_stopped(job)) {
+            state = "Stopped";
+        }
+        printf("[%d]%c  %-8s\t%s\n", job->id, job->next == NULL ? '+' : ' ', state, job->command);
+        job->notified = 1;
+    }
+    
+    // Finished jobs have now been reported; drop them
+    Job* job = job_list;
+    while (job != NULL) {
+        Job* next = job->next;
+        if (job_is_completed(job)) {
+            finish_job(job);
+        }
+        job = next;
+    }
+    return 1;
+}
+
+int shell_fg(char** args) {
+    if (!interactive) {
+        fprintf(stderr, "fg: no job control\n");
+        last_status = 1;
+        return 1;
+    }
+    
+    Job* job = find_job(args[1]);
+    if (job == NULL) {
+        fprintf(stderr, "fg: %s: no such job\n", args[1] ? args[1] : "current");
+        last_status = 1;
+        return 1;
+    }
+    
+    printf("%s\n", job->command);
+    for (int i = 0; i < job->num_procs; i++) {
+        job->procs[i].stopped = 0;
+    }
+    job->notified = 0;
+    run_foreground_job(job, 1);
+    return 1;
+}
+
+int shell_bg(char** args) {
+    if (!interactive) {
+        fprintf(stderr, "bg: no job control\n");
+        last_status = 1;
+        return 1;
+    }
+    
+    Job* job = find_job(args[1]);
+    if (job == NULL) {
+        fprintf(stderr, "bg: %s: no such job\n", args[1] ? args[1] : "current");
+        last_status = 1;
+        return 1;
+    }
+    
+    for (int i = 0; i < job->num_procs; i++) {
+        job->procs[i].stopped = 0;
+    }
+    job->notified = 0;
+    kill(-job->pgid, SIGCONT);
+    printf("[%d]+ %s &\n", job->id, job->command);
+    return 1;
+}
+
+// wait with no arguments waits for every background job
+int shell_wait(char** args) {
+    reap_background_jobs();
+    
+    if (args[1] == NULL) {
+        Job* job = job_list;
+        while (job != NULL) {
+            Job* next = job->next;
+            if (!job_is_stopped(job)) {
+                wait_for_job(job);
+            }
+            if (job_is_completed(job)) {
+                set_status_from_job(job);
+                finish_job(job);
+            }
+            job = next;
+        }
+        return 1;
+    }
+    
+    for (int i = 1; args[i] != NULL; i++) {
+        Job* job = find_job(args[i]);
+        if (job == NULL) {
+            fprintf(stderr, "wait: %s: no such job\n", args[i]);
+            last_status = 127;
+            continue;
+        }
+        wait_for_job(job);
+        if (job_is_completed(job)) {
+            set_status_from_job(job);
+            finish_job(job);
+        }
+    }
+    return 1;
+}
+
+// coproc                      list workers
+// coproc [-l] NAME cmd args   start a worker (-l: line mode, no framing;
+//                             one flushed reply line per request line)
+// coproc -s NAME [text...]    send a request, printing the reply
+// coproc -k NAME              stop a worker
+int shell_coproc(char** args) {
+    reap_background_jobs();
+    
+    if (args[1] == NULL) {
+        for (Worker* worker = worker_list; worker != NULL; worker = worker->next) {
+            printf("%-12s %6d  %-7s %-6s %8lu  %s\n", worker->name, (int)worker->pid,
+                   worker->exited ? "Exited" : "Running", worker->line_mode ? "line" : "frame",
+                   worker->requests, worker->command);
+        }
+        return 1;
+    }
+    
+    if (strcmp(args[1], "-s") == 0 || strcmp(args[1], "-k") == 0) {
+        Worker* worker = args[2] ? find_worker(args[2]) : NULL;
+        if (worker == NULL) {
+            fprintf(stderr, "coproc: %s: no such worker\n", args[2] ? args[2] : "");
+            last_status = 1;
+            return 1;
+        }
+        
+        if (args[1][1] == 'k') {
+            stop_worker(worker);
+            return 1;
+        }
+        
+        // The request is the remaining words joined like echo, or stdin
+        size_t len = 0, cap = 256;
+        char* payload = malloc(cap);
+        if (!payload) {
+            fprintf(stderr, "Memory allocation error\n");
+            exit(1);
+        }
+        
+        if (args[3] != NULL) {
+            for (int i = 3; args[i] != NULL; i++) {
+                size_t word_len = strlen(args[i]);
+                while (len + word_len + 2 > cap) {
+                    cap *= 2;
+                    payload = realloc(payload, cap);
+                    if (!payload) {
+                        fprintf(stderr, "Memory allocation error\n");
+                        exit(1);
+                    }
+                }
+                memcpy(payload + len, args[i], word_len);
+                len += word_len;
+                payload[len++] = args[i + 1] ? ' ' : '\n';
+            }
+        } else {
+            // At top level stdin may be where the shell reads its commands
+            struct stat sb;
+            if (commands_on_stdin && fstat(STDIN_FILENO, &sb) == 0 &&
+                sb.st_dev == command_input.st_dev && sb.st_ino == command_input.st_ino) {
+                fprintf(stderr, "coproc: -s %s: give the text, or redirect or pipe stdin\n",
+                        worker->name);
+                free(payload);
+                last_status = 2;
+                return 1;
+            }
+            ssize_t n;
+            while ((n = read(STDIN_FILENO, payload + len, cap - len)) != 0) {
+                if (n == -1) {
+                    if (errno == EINTR) {
+                        continue;
+                    }
+                    perror("coproc: read");
+                    break;
+                }
+                len += n;
+                if (len == cap) {
+                    cap *= 2;
+                    payload = realloc(payload, cap);
+                    if (!payload) {
+                        fprintf(stderr, "Memory allocation error\n");
+                        exit(1);
+                    }
+                }
+            }
+        }
+        
+        if (worker_request(worker, payload, len) == -1) {
+            last_status = 1;
+        }
+        free(payload);
+        return 1;
+    }
+    
+    int line_mode = strcmp(args[1], "-l") == 0;
+    char* name = args[1 + line_mode];
+    if (name == NULL || args[2 + line_mode] == NULL) {
+        fprintf(stderr, "coproc: usage: coproc [-l] NAME command [args...]\n");
+        last_status = 2;
+        return 1;
+    }
+    if (find_worker(name) != NULL) {
+        fprintf(stderr, "coproc: %s: worker already exists\n", name);
+        last_status = 1;
+        return 1;
+    }
+    if (is_builtin(args[2 + line_mode])) {
+        fprintf(stderr, "coproc: %s: builtins can't run as workers\n", args[2 + line_mode]);
+        last_status = 1;
+        return 1;
+    }
+    
+    if (start_worker(name, &args[2 + line_mode], line_mode) == NULL) {
+        last_status = 127;
+    }
+    return 1;
+}
@@ -0,0 +1,252 @@
+// Benchmarks for studentdata.c. Build and run from this directory:
+//   gcc -O2 -o /tmp/bench_students bench_students.c -lpthread
+//   /tmp/bench_students [rows]
+// The program is compiled in with its main renamed, so every timing goes
+// through the same functions the menu uses.
+#define main studentdata_main
+#include "studentdata.c"
+#undef main
+#include <time.h>
+
+#define DEFAULT_ROWS 900000
+#define REPEATS 10
+#define LINEAR_OPS 2000     // The old linear paths are too slow for more
+#define OLD_CSV "bench_students_old.csv"
+#define NEW_CSV "bench_students_new.csv"
+
+// The fixed array of records the column table replaced
+typedef struct {
+    int id;
+    char name[50];
+    int age;
+    char course[50];
+    float grade;
+} OldStudent;
+
+double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Ids 3, 10, 17, ... in random order, so neither the table nor the
+// index sees them sorted
+int *shuffled_ids(int n) {
+    int *ids = malloc(n * sizeof(int));
+    for (int i = 0; i < n; i++) {
+        ids[i] = i * 7 + 3;
+    }
+    for (int i = n - 1; i > 0; i--) {
+        int j = rand() % (i + 1);
+        int t = ids[i];
+        ids[i] = ids[j];
+        ids[j] = t;
+    }
+    return ids;
+}
+
+// Memory per row and the cost of a full pass over the grades, old array
+// of structs against the grade column
+void bench_layout(const int *ids, int n) {
+    OldStudent *old = malloc(n * sizeof(OldStudent));
+    char name[32], course[32];
+    for (int i = 0; i < n; i++) {
+        snprintf(name, sizeof(name), "Student %d", i % 20000);
+        snprintf(course, sizeof(course), "Course %d", i % 50);
+        float grade = (i * 37 % 10001) / 100.0f;
+        append_student(ids[i], name, 18 + i % 10, course, grade);
+        old[i].id = ids[i];
+        strcpy(old[i].name, name);
+        old[i].age = 18 + i % 10;
+        strcpy(old[i].course, course);
+        old[i].grade = grade;
+    }
+
+    double best_old = 1e9, best_new = 1e9;
+    volatile double sink;
+    for (int r = 0; r < REPEATS; r++) {
+        double t = now_seconds(), sum = 0;
+        for (int i = 0; i < n; i++) {
+            sum += old[i].grade;
+        }
+        sink = sum;
+        t = now_seconds() - t;
+        best_old = t < best_old ? t : best_old;
+
+        t = now_seconds();
+        sum = 0;
+        for (int i = 0; i < students.count; i++) {
+            sum += students.grades[i];
+        }
+        sink = sum;
+        t = now_seconds() - t;
+        best_new = t < best_new ? t : best_new;
+    }
+    (void)sink;
+    printf("layout   structs %zu bytes/row, grade scan %.2f ms\n",
+           sizeof(OldStudent), best_old * 1e3);
+    printf("         columns %zu bytes/row + %zu bytes of strings, grade scan %.2f ms\n",
+           4 * sizeof(int) + sizeof(float), strings.text_used, best_new * 1e3);
+    free(old);
+}
+
+// The old search: a scan of the id column
+int linear_find(int id) {
+    for (int i = 0; i < students.count; i++) {
+        if (students.ids[i] == id) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// The old delete: scan for the row, then shift every later row down
+void shift_delete(int id) {
+    int i = linear_find(id);
+    int after = students.count - i - 1;
+    memmove(&students.ids[i], &students.ids[i + 1], after * sizeof(int));
+    memmove(&students.ages[i], &students.ages[i + 1], after * sizeof(int));
+    memmove(&students.grades[i], &students.grades[i + 1], after * sizeof(float));
+    memmove(&students.names[i], &students.names[i + 1], after * sizeof(int));
+    memmove(&students.courses[i], &students.courses[i + 1], after * sizeof(int));
+    students.count--;
+}
+
+void bench_lookup(const int *ids, int n) {
+    double t = now_seconds();
+    long found = 0;
+    for (int i = 0; i < n; i++) {
+        found += find_student(ids[rand() % n]) != -1;
+    }
+    double indexed = now_seconds() - t;
+
+    t = now_seconds();
+    for (int i = 0; i < LINEAR_OPS; i++) {
+        found += linear_find(ids[rand() % n]) != -1;
+    }
+    double linear = now_seconds() - t;
+    printf("search   index %.0f ns/lookup, linear scan %.0f ns/lookup (%ld found)\n",
+           indexed / n * 1e9, linear / LINEAR_OPS * 1e9, found);
+}
+
+// Deletes every row: a few the old way, the rest by swap-remove. The
+// index is checked against the table before and after the timed part.
+int bench_delete(int *ids, int n) {
+    for (int i = n - 1; i > 0; i--) {
+        int j = rand() % (i + 1);
+        int t = ids[i];
+        ids[i] = ids[j];
+        ids[j] = t;
+    }
+    int shifted = n < LINEAR_OPS ? n : LINEAR_OPS;
+    double t = now_seconds();
+    for (int i = 0; i < shifted; i++) {
+        shift_delete(ids[i]);
+    }
+    double linear = now_seconds() - t;
+    index_rebuild(students.count);
+    for (int i = 0; i < students.count; i++) {
+        if (find_student(students.ids[i]) != i) {
+            printf("index out of step at row %d\n", i);
+            return -1;
+        }
+    }
+
+    t = now_seconds();
+    for (int i = shifted; i < n; i++) {
+        remove_student(find_student(ids[i]));
+    }
+    double indexed = now_seconds() - t;
+    if (n > shifted) {
+        printf("delete   swap-remove %.0f ns/delete, scan + shift %.0f ns/delete\n",
+               indexed / (n - shifted) * 1e9, linear / shifted * 1e9);
+    }
+
+    if (students.count != 0 || id_index.used != 0 || find_student(ids[n - 1]) != -1) {
+        printf("index out of step: %d rows, %d ids left\n", students.count, id_index.used);
+        return -1;
+    }
+    return 0;
+}
+
+// The old save and load loops
+void fprintf_save(const char *path) {
+    FILE *fp = fopen(path, "w");
+    for (int i = 0; i < students.count; i++) {
+        fprintf(fp, "%d,%s,%d,%s,%.2f\n", students.ids[i], string_at(students.names[i]),
+                students.ages[i], string_at(students.courses[i]), students.grades[i]);
+    }
+    fclose(fp);
+}
+
+void fscanf_load(const char *path) {
+    FILE *fp = fopen(path, "r");
+    int id, age;
+    float grade;
+    char name[NAME_LENGTH], course[NAME_LENGTH];
+    while (fscanf(fp, "%d,%49[^,],%d,%49[^,],%f\n", &id, name, &age, course, &grade) == 5) {
+        append_student(id, name, age, course, grade);
+    }
+    fclose(fp);
+}
+
+int same_file(const char *a, const char *b) {
+    FILE *fa = fopen(a, "r"), *fb = fopen(b, "r");
+    int ca, cb;
+    do {
+        ca = getc(fa);
+        cb = getc(fb);
+    } while (ca == cb && ca != EOF);
+    fclose(fa);
+    fclose(fb);
+    return ca == cb;
+}
+
+void bench_save(int n) {
+    double t = now_seconds();
+    fprintf_save(OLD_CSV);
+    double old = now_seconds() - t;
+    t = now_seconds();
+    int status = export_csv(NEW_CSV);
+    double new = now_seconds() - t;
+    printf("save     buffered writer %.3f s (%.2fM rows/s), fprintf %.3f s, %s\n",
+           new, n / new / 1e6, old,
+           status != 0 ? "export failed" : same_file(OLD_CSV, NEW_CSV) ? "same bytes" : "files differ");
+}
+
+// Runs on an empty table, after bench_delete
+void bench_load(int n) {
+    double t = now_seconds();
+    fscanf_load(OLD_CSV);
+    double old = now_seconds() - t;
+    while (students.count > 0) {
+        remove_student(students.count - 1);
+    }
+    t = now_seconds();
+    import_csv(NEW_CSV);
+    double new = now_seconds() - t;
+    printf("load     mmap parser %.3f s (%.2fM rows/s), fscanf %.3f s (%.2fM rows/s), %d rows\n",
+           new, n / new / 1e6, old, n / old / 1e6, students.count);
+    remove(OLD_CSV);
+    remove(NEW_CSV);
+}
+
+int main(int argc, char *argv[]) {
+    int n = argc > 1 ? atoi(argv[1]) : DEFAULT_ROWS;
+    if (n <= 0) {
+        printf("Usage: %s [rows]\n", argv[0]);
+        return 1;
+    }
+    srand(1);
+    int *ids = shuffled_ids(n);
+    printf("%d rows, best of %d where repeated\n", n, REPEATS);
+    bench_layout(ids, n);
+    bench_lookup(ids, n);
+    bench_save(n);
+    int status = bench_delete(ids, n);
+    if (status == 0) {
+        bench_load(n);
+    }
+    free(ids);
+    return status == 0 ? 0 : 1;
+}
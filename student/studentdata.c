@@ -1,19 +1,177 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <errno.h>
+#include <math.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
-#define MAX 100
+#define INITIAL_CAPACITY 1024
+#define TEXT_BLOCK (1 << 20)
+#define NAME_LENGTH 50
+#define MAX_SORT_KEYS 5
+#define MAX_VIEWS 8
+#define MAX_SORT_THREADS 8
+#define PARALLEL_SORT 200000    // Rows before a sort is split across threads
+#define RADIX_SORT 4096         // Rows before a numeric sort uses radix
+#define PARALLEL_LOAD (32 << 20)    // File size before parsing on threads
+#define MAX_REPORTED_ERRORS 10
+#define WRITE_BUFFER (1 << 20)
+#define SNAPSHOT_FILE "students.snap"
+#define SNAPSHOT_MAGIC "STUSNAP"
+#define SNAPSHOT_VERSION 1
+
+// Every distinct name and course is stored once, back to back in one
+// text buffer. Records refer to strings by their index in the pool, and
+// the pool by offsets, so it can be saved and mapped back as it is.
+typedef struct {
+    char *text;
+    size_t text_used;
+    size_t text_capacity;
+    unsigned long long *offsets;    // String id -> offset in text
+    unsigned long long *prefixes;   // First 8 bytes, big-endian, for sorting
+    int num_strings;
+    int strings_capacity;
+    int *table;             // Open addressing hash of string ids, -1 empty
+    int table_size;         // Power of two
+} StringPool;
+
+// Students stored column by column, so a scan touches only the fields it
+// needs: a grade average reads the grades and nothing else
+typedef struct {
+    int *ids;
+    int *ages;
+    float *grades;
+    int *names;             // String ids in the pool
+    int *courses;
+    int count;
+    int capacity;
+} StudentTable;
+
+// Open addressing hash from student id to row, with linear probing. An
+// entry holds the id too, so a probe never has to touch the id column.
+typedef struct {
+    int id;
+    int row;                // -1 for an empty slot
+} IndexSlot;
+
+typedef struct {
+    IndexSlot *slots;
+    int bits;               // The table has 1 << bits slots
+    int used;
+} IdIndex;
+
+typedef enum {
+    FIELD_ID,
+    FIELD_NAME,
+    FIELD_AGE,
+    FIELD_COURSE,
+    FIELD_GRADE
+} Field;
+
+typedef struct {
+    Field field;
+    int descending;
+} SortKey;
+
+// Rows in the order of some sort keys, ties broken by id. A view is a
+// secondary index: the records never move, and adds, updates and deletes
+// insert or remove single entries instead of sorting again.
+typedef struct {
+    SortKey keys[MAX_SORT_KEYS];
+    int num_keys;
+    int *rows;
+    int count;
+    int capacity;
+} SortedView;
+
+// One field of a CSV row, pointing into the file or, once unescaped, into
+// the chunk's text
+typedef struct {
+    const char *text;
+    int len;
+    int quoted;
+} Slice;
 
 typedef struct {
     int id;
-    char name[50];
     int age;
-    char course[50];
     float grade;
-} Student;
+    char *name;
+    char *course;
+} ParsedRow;
 
-Student students[MAX];
-int count = 0;
+// A range of rows of a CSV file, parsed on its own thread
+typedef struct {
+    const char *start;
+    const char *end;
+    ParsedRow *rows;
+    int num_rows;
+    int rows_capacity;
+    char *text;             // Field strings, NUL-terminated
+    size_t text_used;
+    int lines;
+    int num_errors;
+    int error_lines[MAX_REPORTED_ERRORS];   // Relative to the chunk
+    const char *error_messages[MAX_REPORTED_ERRORS];
+    int failed;             // Ran out of memory
+} ParseChunk;
+
+typedef struct {
+    int fd;
+    char *buf;
+    size_t len;
+} CsvWriter;
+
+enum {
+    SECTION_IDS,
+    SECTION_AGES,
+    SECTION_GRADES,
+    SECTION_NAMES,
+    SECTION_COURSES,
+    SECTION_OFFSETS,
+    SECTION_PREFIXES,
+    SECTION_TEXT,
+    SECTION_SLOTS,
+    SECTION_TABLE,
+    NUM_SECTIONS
+};
+
+// A snapshot holds the columns, the string pool and the id index exactly
+// as they sit in memory, in the machine's byte order, each section at an
+// 8-byte aligned offset. Loading maps the file and points at the sections.
+typedef struct {
+    char magic[8];
+    unsigned int version;
+    unsigned int header_size;
+    unsigned long long file_size;
+    unsigned long long checksum;    // Of everything after the header
+    int count;
+    int num_strings;
+    int table_size;
+    int index_bits;
+    int index_slots;        // 0 or 1 << index_bits
+    int index_used;
+    unsigned long long text_size;
+    unsigned long long sections[NUM_SECTIONS];
+} SnapshotHeader;
+
+StudentTable students;
+StringPool strings;
+char *snapshot = NULL;      // Mapped snapshot the store started from
+size_t snapshot_size = 0;
+IdIndex id_index;
+SortedView *views[MAX_VIEWS];
+int num_views = 0;
+SortedView *current_view = NULL;    // Order for viewing and saving
+const char *field_names[] = { "id", "name", "age", "course", "grade" };
 
 // Helper to clear input buffer
 void clear_input() {
@@ -40,7 +198,7 @@ float get_valid_float(const char *prompt) {
     float num;
     while (1) {
         printf("%s", prompt);
-        if (scanf("%f", &num) != 1) {
+        if (scanf("%f", &num) != 1 || !isfinite(num)) {
             printf("Invalid input. Please enter a valid number.\n");
             clear_input();
         } else {
@@ -50,176 +208,1906 @@ float get_valid_float(const char *prompt) {
     }
 }
 
-void add_student() {
-    if (count >= MAX) {
-        printf("Student limit reached.\n");
+// Read a line into buf without its newline
+void get_line(const char *prompt, char *buf, int size) {
+    printf("%s", prompt);
+    if (!fgets(buf, size, stdin)) {
+        buf[0] = '\0';
         return;
     }
+    buf[strcspn(buf, "\n")] = '\0';  // Remove newline
+}
 
-    students[count].id = get_valid_int("Enter ID: ");
-    printf("Enter Name: ");
-    fgets(students[count].name, sizeof(students[count].name), stdin);
-    students[count].name[strcspn(students[count].name, "\n")] = '\0';  // Remove newline
-    students[count].age = get_valid_int("Enter Age: ");
-    printf("Enter Course: ");
-    fgets(students[count].course, sizeof(students[count].course), stdin);
-    students[count].course[strcspn(students[count].course, "\n")] = '\0';
-    students[count].grade = get_valid_float("Enter Grade: ");
+// realloc for arrays that may still live in the mapped snapshot, which
+// can be written (privately) but not resized or freed
+void *grow(void *ptr, size_t used, size_t size) {
+    char *p = ptr;
+    if (p && p >= snapshot && p < snapshot + snapshot_size) {
+        void *copy = malloc(size);
+        if (copy) {
+            memcpy(copy, ptr, used);
+        }
+        return copy;
+    }
+    return realloc(ptr, size);
+}
 
-    count++;
-    printf("Student added successfully!\n");
+void release(void *ptr) {
+    char *p = ptr;
+    if (!(p && p >= snapshot && p < snapshot + snapshot_size)) {
+        free(ptr);
+    }
 }
 
-void display_students() {
-    if (count == 0) {
-        printf("No student records found.\n");
-        return;
+unsigned int hash_string(const char *s) {
+    unsigned int hash = 2166136261u;
+    for (; *s; s++) {
+        hash ^= (unsigned char)*s;
+        hash *= 16777619u;
     }
+    return hash;
+}
 
-    for (int i = 0; i < count; i++) {
-        printf("\nID: %d\nName: %s\nAge: %d\nCourse: %s\nGrade: %.2f\n",
-               students[i].id, students[i].name, students[i].age, students[i].course, students[i].grade);
+// Copy s onto the end of the pool's text; returns its offset, or -1
+long long text_append(StringPool *pool, const char *s) {
+    size_t len = strlen(s) + 1;
+    if (pool->text_used + len > pool->text_capacity) {
+        size_t capacity = pool->text_capacity ? pool->text_capacity : TEXT_BLOCK;
+        while (pool->text_used + len > capacity) {
+            capacity *= 2;
+        }
+        char *text = grow(pool->text, pool->text_used, capacity);
+        if (!text) {
+            return -1;
+        }
+        pool->text = text;
+        pool->text_capacity = capacity;
     }
+    long long offset = pool->text_used;
+    memcpy(pool->text + offset, s, len);
+    pool->text_used += len;
+    return offset;
 }
 
-void search_student() {
-    int id = get_valid_int("Enter ID to search: ");
-    int found = 0;
+const char *pool_string(const StringPool *pool, int id) {
+    return pool->text + pool->offsets[id];
+}
 
-    for (int i = 0; i < count; i++) {
-        if (students[i].id == id) {
-            printf("Student found:\nID: %d\nName: %s\nAge: %d\nCourse: %s\nGrade: %.2f\n",
-                   students[i].id, students[i].name, students[i].age, students[i].course, students[i].grade);
-            found = 1;
-            break;
+// Rehash every string id into a table twice the size
+int grow_table(StringPool *pool) {
+    int size = pool->table_size ? pool->table_size * 2 : 1024;
+    int *table = malloc(size * sizeof(int));
+    if (!table) {
+        return -1;
+    }
+    memset(table, -1, size * sizeof(int));
+    for (int id = 0; id < pool->num_strings; id++) {
+        unsigned int slot = hash_string(pool_string(pool, id)) & (size - 1);
+        while (table[slot] != -1) {
+            slot = (slot + 1) & (size - 1);
         }
+        table[slot] = id;
     }
+    release(pool->table);
+    pool->table = table;
+    pool->table_size = size;
+    return 0;
+}
 
-    if (!found) {
-        printf("Student not found.\n");
+// Id of s in the pool, adding it on first sight; -1 when out of memory
+int intern(StringPool *pool, const char *s) {
+    if ((pool->num_strings + 1) * 2 > pool->table_size && grow_table(pool) != 0) {
+        return -1;
+    }
+    unsigned int slot = hash_string(s) & (pool->table_size - 1);
+    while (pool->table[slot] != -1) {
+        if (strcmp(pool_string(pool, pool->table[slot]), s) == 0) {
+            return pool->table[slot];
+        }
+        slot = (slot + 1) & (pool->table_size - 1);
+    }
+
+    if (pool->num_strings == pool->strings_capacity) {
+        int capacity = pool->strings_capacity ? pool->strings_capacity * 2 : 1024;
+        size_t used = pool->num_strings * sizeof(unsigned long long);
+        unsigned long long *offsets = grow(pool->offsets, used,
+                                           capacity * sizeof(unsigned long long));
+        if (!offsets) {
+            return -1;
+        }
+        pool->offsets = offsets;
+        unsigned long long *prefixes = grow(pool->prefixes, used,
+                                            capacity * sizeof(unsigned long long));
+        if (!prefixes) {
+            return -1;
+        }
+        pool->prefixes = prefixes;
+        pool->strings_capacity = capacity;
+    }
+    long long offset = text_append(pool, s);
+    if (offset == -1) {
+        return -1;
+    }
+    // Comparing prefixes orders most strings without touching the text
+    unsigned long long prefix = 0;
+    for (int i = 0, done = 0; i < 8; i++) {
+        if (!s[i]) {
+            done = 1;
+        }
+        prefix = prefix << 8 | (done ? 0 : (unsigned char)s[i]);
     }
+    pool->prefixes[pool->num_strings] = prefix;
+    pool->offsets[pool->num_strings] = offset;
+    pool->table[slot] = pool->num_strings;
+    return pool->num_strings++;
 }
 
-void update_student() {
-    int id = get_valid_int("Enter ID of student to update: ");
-    int found = 0;
-
-    for (int i = 0; i < count; i++) {
-        if (students[i].id == id) {
-            printf("Updating record for %s...\n", students[i].name);
-            printf("Enter new name: ");
-            fgets(students[i].name, sizeof(students[i].name), stdin);
-            students[i].name[strcspn(students[i].name, "\n")] = '\0';
-            students[i].age = get_valid_int("Enter new age: ");
-            printf("Enter new course: ");
-            fgets(students[i].course, sizeof(students[i].course), stdin);
-            students[i].course[strcspn(students[i].course, "\n")] = '\0';
-            students[i].grade = get_valid_float("Enter new grade: ");
-            printf("Student updated successfully.\n");
-            found = 1;
-            break;
+const char *string_at(int id) {
+    return pool_string(&strings, id);
+}
+
+// Fibonacci hashing: the top bits of the product spread sequential ids
+unsigned int index_slot(int id) {
+    return ((unsigned int)id * 2654435769u) >> (32 - id_index.bits);
+}
+
+// Place id in a table known to have room and not to hold it yet
+void index_place(int id, int row) {
+    unsigned int mask = (1u << id_index.bits) - 1;
+    unsigned int slot = index_slot(id);
+    while (id_index.slots[slot].row != -1) {
+        slot = (slot + 1) & mask;
+    }
+    id_index.slots[slot].id = id;
+    id_index.slots[slot].row = row;
+    id_index.used++;
+}
+
+// Rebuild the index from the id column, sized for at least capacity ids
+int index_rebuild(int capacity) {
+    int bits = 10;
+    while ((1 << bits) < capacity * 2) {
+        bits++;
+    }
+    IndexSlot *slots = malloc(sizeof(IndexSlot) << bits);
+    if (!slots) {
+        printf("Out of memory.\n");
+        return -1;
+    }
+    for (int i = 0; i < 1 << bits; i++) {
+        slots[i].row = -1;
+    }
+    release(id_index.slots);
+    id_index.slots = slots;
+    id_index.bits = bits;
+    id_index.used = 0;
+    for (int i = 0; i < students.count; i++) {
+        index_place(students.ids[i], i);
+    }
+    return 0;
+}
+
+// Slot holding id, or -1
+int index_lookup(int id) {
+    if (id_index.used == 0) {
+        return -1;
+    }
+    unsigned int mask = (1u << id_index.bits) - 1;
+    unsigned int slot = index_slot(id);
+    while (id_index.slots[slot].row != -1) {
+        if (id_index.slots[slot].id == id) {
+            return slot;
         }
+        slot = (slot + 1) & mask;
     }
+    return -1;
+}
 
-    if (!found) {
-        printf("Student not found.\n");
+// Row of the student with this id, or -1
+int find_student(int id) {
+    int slot = index_lookup(id);
+    return slot == -1 ? -1 : id_index.slots[slot].row;
+}
+
+// Add id, keeping the table at most half full
+int index_insert(int id, int row) {
+    if ((id_index.used + 1) * 2 > 1 << id_index.bits &&
+        index_rebuild(id_index.used + 1) != 0) {
+        return -1;
     }
+    index_place(id, row);
+    return 0;
 }
 
-void delete_student() {
-    int id = get_valid_int("Enter ID of student to delete: ");
-    int found = 0;
+// Remove id, shifting later entries of its probe run back so that
+// lookups never need tombstones
+void index_remove(int id) {
+    int slot = index_lookup(id);
+    if (slot == -1) {
+        return;
+    }
+    unsigned int mask = (1u << id_index.bits) - 1;
+    unsigned int hole = slot;
+    unsigned int next = (hole + 1) & mask;
+    while (id_index.slots[next].row != -1) {
+        unsigned int home = index_slot(id_index.slots[next].id);
+        // Move the entry back unless its home lies between the hole and it
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            id_index.slots[hole] = id_index.slots[next];
+            hole = next;
+        }
+        next = (next + 1) & mask;
+    }
+    id_index.slots[hole].row = -1;
+    id_index.used--;
+}
+
+// Order two string ids by their text
+int compare_strings(int a, int b) {
+    if (a == b) {
+        return 0;
+    }
+    unsigned long long pa = strings.prefixes[a], pb = strings.prefixes[b];
+    if (pa != pb) {
+        return pa < pb ? -1 : 1;
+    }
+    return strcmp(string_at(a), string_at(b));
+}
+
+// Order rows a and b by the view's keys, then by id
+int compare_rows(const SortedView *view, int a, int b) {
+    for (int k = 0; k < view->num_keys; k++) {
+        int c = 0;
+        switch (view->keys[k].field) {
+            case FIELD_ID:
+                c = (students.ids[a] > students.ids[b]) - (students.ids[a] < students.ids[b]);
+                break;
+            case FIELD_NAME:
+                c = compare_strings(students.names[a], students.names[b]);
+                break;
+            case FIELD_AGE:
+                c = (students.ages[a] > students.ages[b]) - (students.ages[a] < students.ages[b]);
+                break;
+            case FIELD_COURSE:
+                c = compare_strings(students.courses[a], students.courses[b]);
+                break;
+            case FIELD_GRADE:
+                c = (students.grades[a] > students.grades[b]) -
+                    (students.grades[a] < students.grades[b]);
+                break;
+        }
+        if (c != 0) {
+            return view->keys[k].descending ? -c : c;
+        }
+    }
+    return (students.ids[a] > students.ids[b]) - (students.ids[a] < students.ids[b]);
+}
+
+void insertion_sort(const SortedView *view, int *rows, int n) {
+    for (int i = 1; i < n; i++) {
+        int row = rows[i];
+        int j = i;
+        while (j > 0 && compare_rows(view, rows[j - 1], row) > 0) {
+            rows[j] = rows[j - 1];
+            j--;
+        }
+        rows[j] = row;
+    }
+}
+
+void sift_down(const SortedView *view, int *rows, int root, int n) {
+    while (2 * root + 1 < n) {
+        int child = 2 * root + 1;
+        if (child + 1 < n && compare_rows(view, rows[child], rows[child + 1]) < 0) {
+            child++;
+        }
+        if (compare_rows(view, rows[root], rows[child]) >= 0) {
+            return;
+        }
+        int tmp = rows[root];
+        rows[root] = rows[child];
+        rows[child] = tmp;
+        root = child;
+    }
+}
+
+void heap_sort(const SortedView *view, int *rows, int n) {
+    for (int i = n / 2 - 1; i >= 0; i--) {
+        sift_down(view, rows, i, n);
+    }
+    for (int end = n - 1; end > 0; end--) {
+        int tmp = rows[0];
+        rows[0] = rows[end];
+        rows[end] = tmp;
+        sift_down(view, rows, 0, end);
+    }
+}
+
+// Quicksort with a median-of-three pivot, handing a partition that
+// recurses too deep to heapsort so the worst case stays O(n log n)
+void intro_sort(const SortedView *view, int *rows, int n, int depth) {
+    while (n > 16) {
+        if (depth-- == 0) {
+            heap_sort(view, rows, n);
+            return;
+        }
+        int a = rows[0], b = rows[n / 2], c = rows[n - 1];
+        int pivot;
+        if (compare_rows(view, a, b) < 0) {
+            pivot = compare_rows(view, b, c) < 0 ? b : (compare_rows(view, a, c) < 0 ? c : a);
+        } else {
+            pivot = compare_rows(view, a, c) < 0 ? a : (compare_rows(view, b, c) < 0 ? c : b);
+        }
 
-    for (int i = 0; i < count; i++) {
-        if (students[i].id == id) {
-            for (int j = i; j < count - 1; j++) {
-                students[j] = students[j + 1];
+        int i = 0, j = n - 1;
+        while (i <= j) {
+            while (compare_rows(view, rows[i], pivot) < 0) i++;
+            while (compare_rows(view, rows[j], pivot) > 0) j--;
+            if (i <= j) {
+                int tmp = rows[i];
+                rows[i] = rows[j];
+                rows[j] = tmp;
+                i++;
+                j--;
             }
-            count--;
-            printf("Student deleted successfully.\n");
-            found = 1;
-            break;
+        }
+        // Recurse into the smaller side and loop on the larger
+        if (j + 1 < n - i) {
+            intro_sort(view, rows, j + 1, depth);
+            rows += i;
+            n -= i;
+        } else {
+            intro_sort(view, rows + i, n - i, depth);
+            n = j + 1;
         }
     }
+    insertion_sort(view, rows, n);
+}
 
-    if (!found) {
-        printf("Student not found.\n");
+void comparison_sort(const SortedView *view, int *rows, int n) {
+    int depth = 0;
+    for (int m = n; m > 1; m >>= 1) {
+        depth += 2;
     }
+    intro_sort(view, rows, n, depth);
 }
 
-void sort_students() {
-    for (int i = 0; i < count - 1; i++) {
-        for (int j = 0; j < count - i - 1; j++) {
-            if (strcmp(students[j].name, students[j + 1].name) > 0) {
-                Student temp = students[j];
-                students[j] = students[j + 1];
-                students[j + 1] = temp;
+typedef struct {
+    const SortedView *view;
+    int *rows;
+    int n;
+    int *other;             // Second run for a merge, then where it goes
+    int other_n;
+    int *out;
+} SortTask;
+
+void *sort_task(void *arg) {
+    SortTask *task = (SortTask *)arg;
+    comparison_sort(task->view, task->rows, task->n);
+    return NULL;
+}
+
+void *merge_task(void *arg) {
+    SortTask *task = (SortTask *)arg;
+    int i = 0, j = 0, k = 0;
+    while (i < task->n && j < task->other_n) {
+        if (compare_rows(task->view, task->other[j], task->rows[i]) < 0) {
+            task->out[k++] = task->other[j++];
+        } else {
+            task->out[k++] = task->rows[i++];
+        }
+    }
+    memcpy(task->out + k, task->rows + i, (task->n - i) * sizeof(int));
+    k += task->n - i;
+    memcpy(task->out + k, task->other + j, (task->other_n - j) * sizeof(int));
+    return NULL;
+}
+
+// Sort runs on separate threads, then merge neighbouring runs pairwise,
+// each merge on its own thread, until one run is left
+int parallel_sort(const SortedView *view, int *rows, int n, int threads) {
+    int *buffer = malloc(n * sizeof(int));
+    if (!buffer) {
+        return -1;
+    }
+    pthread_t tids[MAX_SORT_THREADS];
+    SortTask tasks[MAX_SORT_THREADS];
+    int starts[MAX_SORT_THREADS + 1];
+    for (int t = 0; t <= threads; t++) {
+        starts[t] = (long)n * t / threads;
+    }
+
+    int started = 0;
+    for (int t = 0; t < threads; t++) {
+        tasks[t].view = view;
+        tasks[t].rows = rows + starts[t];
+        tasks[t].n = starts[t + 1] - starts[t];
+        if (pthread_create(&tids[t], NULL, sort_task, &tasks[t]) == 0) {
+            started |= 1 << t;
+        } else {
+            sort_task(&tasks[t]);
+        }
+    }
+    for (int t = 0; t < threads; t++) {
+        if (started & (1 << t)) {
+            pthread_join(tids[t], NULL);
+        }
+    }
+
+    int *from = rows, *to = buffer;
+    for (int runs = threads; runs > 1; runs = (runs + 1) / 2) {
+        int pairs = 0;
+        started = 0;
+        for (int r = 0; r < runs; r += 2) {
+            SortTask *task = &tasks[pairs];
+            int hi = r + 2 <= runs ? r + 2 : runs;
+            task->view = view;
+            task->rows = from + starts[r];
+            task->n = starts[r + 1] - starts[r];
+            task->other = from + starts[r + 1];
+            task->other_n = starts[hi] - starts[r + 1];
+            task->out = to + starts[r];
+            if (pthread_create(&tids[pairs], NULL, merge_task, task) == 0) {
+                started |= 1 << pairs;
+            } else {
+                merge_task(task);
+            }
+            pairs++;
+        }
+        for (int t = 0; t < pairs; t++) {
+            if (started & (1 << t)) {
+                pthread_join(tids[t], NULL);
             }
         }
+        // Run boundaries for the next pass
+        for (int r = 0; 2 * r < runs; r++) {
+            starts[r] = starts[2 * r];
+        }
+        starts[(runs + 1) / 2] = n;
+        int *tmp = from;
+        from = to;
+        to = tmp;
+    }
+    if (from != rows) {
+        memcpy(rows, from, n * sizeof(int));
     }
-    printf("Students sorted by name.\n");
+    free(buffer);
+    return 0;
 }
 
-void save_to_file() {
-    FILE *fp = fopen("students.txt", "w");
-    if (!fp) {
-        printf("Error saving to file.\n");
-        return;
+// A numeric field as an unsigned key in the same order
+unsigned int numeric_key(Field field, int row) {
+    if (field == FIELD_GRADE) {
+        unsigned int bits;
+        memcpy(&bits, &students.grades[row], sizeof(bits));
+        // compare_rows treats -0.0 and +0.0 as equal, so they share a key
+        if (bits == 0x80000000u) {
+            bits = 0;
+        }
+        return bits & 0x80000000u ? ~bits : bits | 0x80000000u;
+    }
+    int value = field == FIELD_ID ? students.ids[row] : students.ages[row];
+    return (unsigned int)value ^ 0x80000000u;
+}
+
+// One numeric key: LSD radix sort on the key with the id below it, 16
+// bits at a time, skipping digits every row shares
+int radix_sort(const SortedView *view, int *rows, int n) {
+    unsigned long long *keys = malloc(2 * n * sizeof(unsigned long long));
+    int *tmp_rows = malloc(n * sizeof(int));
+    unsigned int *counts = malloc(65536 * sizeof(unsigned int));
+    if (!keys || !tmp_rows || !counts) {
+        free(keys);
+        free(tmp_rows);
+        free(counts);
+        return -1;
+    }
+    unsigned long long *tmp_keys = keys + n;
+    Field field = view->keys[0].field;
+    for (int i = 0; i < n; i++) {
+        unsigned long long key = numeric_key(field, rows[i]);
+        if (view->keys[0].descending) {
+            key = ~key & 0xffffffffu;
+        }
+        unsigned int id = (unsigned int)students.ids[rows[i]] ^ 0x80000000u;
+        keys[i] = field == FIELD_ID ? key << 32 : key << 32 | id;
     }
 
-    for (int i = 0; i < count; i++) {
-        fprintf(fp, "%d,%s,%d,%s,%.2f\n", students[i].id, students[i].name, students[i].age,
-                students[i].course, students[i].grade);
+    for (int shift = 0; shift < 64; shift += 16) {
+        memset(counts, 0, 65536 * sizeof(unsigned int));
+        for (int i = 0; i < n; i++) {
+            counts[(keys[i] >> shift) & 0xffff]++;
+        }
+        if (counts[(keys[0] >> shift) & 0xffff] == (unsigned int)n) {
+            continue;
+        }
+        unsigned int total = 0;
+        for (int d = 0; d < 65536; d++) {
+            unsigned int c = counts[d];
+            counts[d] = total;
+            total += c;
+        }
+        for (int i = 0; i < n; i++) {
+            unsigned int at = counts[(keys[i] >> shift) & 0xffff]++;
+            tmp_keys[at] = keys[i];
+            tmp_rows[at] = rows[i];
+        }
+        memcpy(keys, tmp_keys, n * sizeof(unsigned long long));
+        memcpy(rows, tmp_rows, n * sizeof(int));
     }
-    fclose(fp);
+    free(keys);
+    free(tmp_rows);
+    free(counts);
+    return 0;
 }
 
-void load_from_file() {
-    FILE *fp = fopen("students.txt", "r");
-    if (!fp) return;
+// Fill the view with every row in order
+int build_view(SortedView *view) {
+    int n = students.count;
+    if (n > view->capacity) {
+        int *rows = realloc(view->rows, n * sizeof(int));
+        if (!rows) {
+            return -1;
+        }
+        view->rows = rows;
+        view->capacity = n;
+    }
+    for (int i = 0; i < n; i++) {
+        view->rows[i] = i;
+    }
+    view->count = n;
 
-    while (fscanf(fp, "%d,%49[^,],%d,%49[^,],%f\n",
-                  &students[count].id,
-                  students[count].name,
-                  &students[count].age,
-                  students[count].course,
-                  &students[count].grade) == 5) {
-        count++;
+    Field first = view->keys[0].field;
+    if (view->num_keys == 1 && first != FIELD_NAME && first != FIELD_COURSE && n >= RADIX_SORT &&
+        radix_sort(view, view->rows, n) == 0) {
+        return 0;
+    }
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads > MAX_SORT_THREADS) {
+        threads = MAX_SORT_THREADS;
     }
-    fclose(fp);
+    if (n >= PARALLEL_SORT && threads > 1 && parallel_sort(view, view->rows, n, threads) == 0) {
+        return 0;
+    }
+    comparison_sort(view, view->rows, n);
+    return 0;
 }
 
-int main() {
-    load_from_file();
-    int choice;
+// Position of row in the view, or where it would go
+int view_position(const SortedView *view, int row) {
+    int lo = 0, hi = view->count;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (compare_rows(view, view->rows[mid], row) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
 
-    do {
-        printf("\n--- Student Management System ---\n");
-        printf("1. Add Student\n");
-        printf("2. View Students\n");
-        printf("3. Search Student\n");
-        printf("4. Update Student\n");
-        printf("5. Delete Student\n");
-        printf("6. Sort Students by Name\n");
-        printf("7. Save & Exit\n");
+// Keep every view in step with the table. Call views_remove before a
+// row's fields change and views_insert after.
+void views_insert(int row) {
+    for (int v = 0; v < num_views; v++) {
+        SortedView *view = views[v];
+        if (view->count == view->capacity) {
+            int capacity = view->capacity ? view->capacity * 2 : INITIAL_CAPACITY;
+            int *rows = realloc(view->rows, capacity * sizeof(int));
+            if (!rows) {
+                // Rebuilt from scratch the next time it is asked for
+                view->count = -1;
+                continue;
+            }
+            view->rows = rows;
+            view->capacity = capacity;
+        }
+        if (view->count < 0) {
+            continue;
+        }
+        int at = view_position(view, row);
+        memmove(&view->rows[at + 1], &view->rows[at], (view->count - at) * sizeof(int));
+        view->rows[at] = row;
+        view->count++;
+    }
+}
 
-        choice = get_valid_int("Enter your choice: ");
+// Index of row in the view, checked rather than trusted: the search
+// lands on the first entry that sorts equal to row, so step through the
+// equal ones to find row itself. -1 when it is missing.
+int view_find(const SortedView *view, int row) {
+    int at = view_position(view, row);
+    while (at < view->count && view->rows[at] != row &&
+           compare_rows(view, view->rows[at], row) == 0) {
+        at++;
+    }
+    return at < view->count && view->rows[at] == row ? at : -1;
+}
 
-        switch (choice) {
-            case 1: add_student(); break;
-            case 2: display_students(); break;
-            case 3: search_student(); break;
-            case 4: update_student(); break;
-            case 5: delete_student(); break;
-            case 6: sort_students(); break;
-            case 7:
-                save_to_file();
-                printf("Data saved. Exiting...\n");
-                break;
-            default: printf("Invalid choice.\n");
+void views_remove(int row) {
+    for (int v = 0; v < num_views; v++) {
+        SortedView *view = views[v];
+        if (view->count < 0) {
+            continue;
+        }
+        int at = view_find(view, row);
+        if (at == -1) {
+            // Out of order somehow; rebuilt the next time it is asked for
+            view->count = -1;
+            continue;
+        }
+        memmove(&view->rows[at], &view->rows[at + 1], (view->count - at - 1) * sizeof(int));
+        view->count--;
+    }
+}
+
+// The record at from moved to row to without changing its fields
+void views_move(int from, int to) {
+    for (int v = 0; v < num_views; v++) {
+        SortedView *view = views[v];
+        if (view->count < 0) {
+            continue;
+        }
+        int at = view_find(view, from);
+        if (at == -1) {
+            view->count = -1;
+            continue;
+        }
+        view->rows[at] = to;
+    }
+}
+
+// The view for these keys, built on first use and kept up to date after
+SortedView *get_view(const SortKey *keys, int num_keys) {
+    for (int v = 0; v < num_views; v++) {
+        SortedView *view = views[v];
+        if (view->num_keys == num_keys && memcmp(view->keys, keys, num_keys * sizeof(SortKey)) == 0) {
+            if (view->count < 0 && build_view(view) != 0) {
+                return NULL;
+            }
+            return view;
+        }
+    }
+
+    SortedView *view;
+    if (num_views == MAX_VIEWS) {
+        // Reuse the oldest view, keeping its buffer
+        view = views[0];
+        memmove(&views[0], &views[1], (MAX_VIEWS - 1) * sizeof(SortedView *));
+        num_views--;
+        if (current_view == view) {
+            current_view = NULL;
+        }
+    } else {
+        view = calloc(1, sizeof(SortedView));
+        if (!view) {
+            return NULL;
+        }
+    }
+    memcpy(view->keys, keys, num_keys * sizeof(SortKey));
+    view->num_keys = num_keys;
+    if (build_view(view) != 0) {
+        free(view->rows);
+        free(view);
+        return NULL;
+    }
+    views[num_views++] = view;
+    return view;
+}
+
+// Rows in the current sort order, or NULL for table order. A view that
+// went stale is rebuilt first.
+const int *current_order() {
+    if (current_view && current_view->count < 0 && build_view(current_view) != 0) {
+        current_view = NULL;
+    }
+    return current_view ? current_view->rows : NULL;
+}
+
+// Parse "course, grade desc" into sort keys; returns how many, or -1
+int parse_sort_keys(char *spec, SortKey *keys) {
+    int num_keys = 0;
+    for (char *part = strtok(spec, ","); part; part = strtok(NULL, ",")) {
+        char field[16] = "", order[16] = "";
+        if (sscanf(part, "%15s %15s", field, order) < 1) {
+            continue;
+        }
+        for (char *c = field; *c; c++) *c = tolower((unsigned char)*c);
+        for (char *c = order; *c; c++) *c = tolower((unsigned char)*c);
+
+        int found = -1;
+        for (int f = 0; f <= FIELD_GRADE; f++) {
+            if (strcmp(field, field_names[f]) == 0) {
+                found = f;
+            }
+        }
+        if (found == -1 || num_keys == MAX_SORT_KEYS ||
+            (order[0] && strcmp(order, "asc") != 0 && strcmp(order, "desc") != 0)) {
+            return -1;
         }
-    } while (choice != 7);
+        keys[num_keys].field = found;
+        keys[num_keys].descending = strcmp(order, "desc") == 0;
+        num_keys++;
+    }
+    return num_keys > 0 ? num_keys : -1;
+}
+
+// Make room for at least capacity students in every column
+int reserve_students(int capacity) {
+    if (capacity <= students.capacity) {
+        return 0;
+    }
+    int new_capacity = students.capacity ? students.capacity : INITIAL_CAPACITY;
+    while (new_capacity < capacity) {
+        new_capacity *= 2;
+    }
+
+    size_t used = students.count * sizeof(int);
+    int *ids = grow(students.ids, used, new_capacity * sizeof(int));
+    if (ids) students.ids = ids;
+    int *ages = grow(students.ages, used, new_capacity * sizeof(int));
+    if (ages) students.ages = ages;
+    float *grades = grow(students.grades, used, new_capacity * sizeof(float));
+    if (grades) students.grades = grades;
+    int *names = grow(students.names, used, new_capacity * sizeof(int));
+    if (names) students.names = names;
+    int *courses = grow(students.courses, used, new_capacity * sizeof(int));
+    if (courses) students.courses = courses;
 
+    if (!ids || !ages || !grades || !names || !courses) {
+        printf("Out of memory.\n");
+        return -1;
+    }
+    students.capacity = new_capacity;
     return 0;
 }
 
+// Append a student; returns its row, or -1 when the id is taken or
+// memory runs out
+int append_student(int id, const char *name, int age, const char *course, float grade) {
+    if (find_student(id) != -1) {
+        return -1;
+    }
+    if (reserve_students(students.count + 1) != 0) {
+        return -1;
+    }
+    int name_id = intern(&strings, name);
+    int course_id = intern(&strings, course);
+    if (name_id == -1 || course_id == -1) {
+        printf("Out of memory.\n");
+        return -1;
+    }
+
+    int row = students.count;
+    if (index_insert(id, row) != 0) {
+        return -1;
+    }
+    students.ids[row] = id;
+    students.names[row] = name_id;
+    students.ages[row] = age;
+    students.courses[row] = course_id;
+    students.grades[row] = grade;
+    students.count++;
+    views_insert(row);
+    return row;
+}
+
+void print_student(int i) {
+    printf("ID: %d\nName: %s\nAge: %d\nCourse: %s\nGrade: %.2f\n",
+           students.ids[i], string_at(students.names[i]), students.ages[i],
+           string_at(students.courses[i]), students.grades[i]);
+}
+
+// Delete a row by moving the last row into it, so nothing is shifted
+void remove_student(int row) {
+    int last = students.count - 1;
+    index_remove(students.ids[row]);
+    views_remove(row);
+    if (row != last) {
+        views_move(last, row);
+        students.ids[row] = students.ids[last];
+        students.ages[row] = students.ages[last];
+        students.grades[row] = students.grades[last];
+        students.names[row] = students.names[last];
+        students.courses[row] = students.courses[last];
+        id_index.slots[index_lookup(students.ids[row])].row = row;
+    }
+    students.count--;
+}
+
+void add_student() {
+    char name[NAME_LENGTH];
+    char course[NAME_LENGTH];
+
+    int id = get_valid_int("Enter ID: ");
+    if (find_student(id) != -1) {
+        printf("A student with ID %d already exists.\n", id);
+        return;
+    }
+    get_line("Enter Name: ", name, sizeof(name));
+    int age = get_valid_int("Enter Age: ");
+    get_line("Enter Course: ", course, sizeof(course));
+    float grade = get_valid_float("Enter Grade: ");
+
+    if (append_student(id, name, age, course, grade) == -1) {
+        return;
+    }
+    printf("Student added successfully!\n");
+}
+
+void display_students() {
+    if (students.count == 0) {
+        printf("No student records found.\n");
+        return;
+    }
+
+    const int *order = current_order();
+    for (int i = 0; i < students.count; i++) {
+        printf("\n");
+        print_student(order ? order[i] : i);
+    }
+}
+
+void search_student() {
+    int id = get_valid_int("Enter ID to search: ");
+    int i = find_student(id);
+
+    if (i != -1) {
+        printf("Student found:\n");
+        print_student(i);
+    } else {
+        printf("Student not found.\n");
+    }
+}
+
+void update_student() {
+    int id = get_valid_int("Enter ID of student to update: ");
+    int i = find_student(id);
+    char name[NAME_LENGTH];
+    char course[NAME_LENGTH];
+
+    if (i == -1) {
+        printf("Student not found.\n");
+        return;
+    }
+
+    printf("Updating record for %s...\n", string_at(students.names[i]));
+    get_line("Enter new name: ", name, sizeof(name));
+    int age = get_valid_int("Enter new age: ");
+    get_line("Enter new course: ", course, sizeof(course));
+    float grade = get_valid_float("Enter new grade: ");
+
+    // The old strings stay in the pool; other students may share them
+    int name_id = intern(&strings, name);
+    int course_id = intern(&strings, course);
+    if (name_id == -1 || course_id == -1) {
+        printf("Out of memory.\n");
+        return;
+    }
+    views_remove(i);
+    students.names[i] = name_id;
+    students.ages[i] = age;
+    students.courses[i] = course_id;
+    students.grades[i] = grade;
+    views_insert(i);
+    printf("Student updated successfully.\n");
+}
+
+void delete_student() {
+    int id = get_valid_int("Enter ID of student to delete: ");
+    int i = find_student(id);
+
+    if (i != -1) {
+        remove_student(i);
+        printf("Student deleted successfully.\n");
+    } else {
+        printf("Student not found.\n");
+    }
+}
+
+// Pick the order for viewing and saving. Each order asked for is kept as
+// a view, so asking again costs nothing.
+void sort_students() {
+    char spec[128];
+    SortKey keys[MAX_SORT_KEYS];
+
+    get_line("Sort by (id, name, age, course, grade; e.g. course, grade desc): ", spec, sizeof(spec));
+    int num_keys = parse_sort_keys(spec, keys);
+    if (num_keys == -1) {
+        printf("Invalid sort order.\n");
+        return;
+    }
+    SortedView *view = get_view(keys, num_keys);
+    if (!view) {
+        printf("Out of memory.\n");
+        return;
+    }
+    current_view = view;
+
+    printf("Students sorted by ");
+    for (int k = 0; k < num_keys; k++) {
+        printf("%s%s%s", k ? ", " : "", field_names[keys[k].field],
+               keys[k].descending ? " (descending)" : "");
+    }
+    printf(".\n");
+}
+
+// Grade summary over the grade column, then an average per course that
+// reads only the course and grade columns
+void grade_statistics() {
+    if (students.count == 0) {
+        printf("No student records found.\n");
+        return;
+    }
+
+    double sum = 0;
+    float min = students.grades[0], max = students.grades[0];
+    for (int i = 0; i < students.count; i++) {
+        float grade = students.grades[i];
+        sum += grade;
+        if (grade < min) min = grade;
+        if (grade > max) max = grade;
+    }
+    printf("\nStudents: %d\nAverage grade: %.2f\nLowest: %.2f\nHighest: %.2f\n",
+           students.count, sum / students.count, min, max);
+
+    // Course ids index straight into the totals
+    double *course_sum = calloc(strings.num_strings, sizeof(double));
+    int *course_count = calloc(strings.num_strings, sizeof(int));
+    if (!course_sum || !course_count) {
+        printf("Out of memory.\n");
+        free(course_sum);
+        free(course_count);
+        return;
+    }
+    for (int i = 0; i < students.count; i++) {
+        course_sum[students.courses[i]] += students.grades[i];
+        course_count[students.courses[i]]++;
+    }
+    printf("\nAverage by course:\n");
+    for (int c = 0; c < strings.num_strings; c++) {
+        if (course_count[c] > 0) {
+            printf("  %-30s %8d students  %.2f\n", string_at(c), course_count[c],
+                   course_sum[c] / course_count[c]);
+        }
+    }
+    free(course_sum);
+    free(course_count);
+}
+
+// Next byte at or after p that can end an unquoted field: a comma, quote,
+// CR or newline. SSE2 checks 16 bytes per step; end if there is none.
+const char *find_special(const char *p, const char *end) {
+#ifdef __SSE2__
+    const __m128i comma = _mm_set1_epi8(',');
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i cr = _mm_set1_epi8('\r');
+    while (end - p >= 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)p);
+        __m128i hits = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, comma),
+                                                 _mm_cmpeq_epi8(chunk, quote)),
+                                    _mm_or_si128(_mm_cmpeq_epi8(chunk, newline),
+                                                 _mm_cmpeq_epi8(chunk, cr)));
+        int mask = _mm_movemask_epi8(hits);
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+#endif
+    while (p < end && *p != ',' && *p != '"' && *p != '\n' && *p != '\r') {
+        p++;
+    }
+    return p;
+}
+
+// Quote characters in [p, end), to tell whether a newline is inside quotes
+long count_quotes(const char *p, const char *end) {
+    long quotes = 0;
+#ifdef __SSE2__
+    const __m128i quote = _mm_set1_epi8('"');
+    while (end - p >= 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)p);
+        quotes += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, quote)));
+        p += 16;
+    }
+#endif
+    for (; p < end; p++) {
+        quotes += *p == '"';
+    }
+    return quotes;
+}
+
+// Split the next field of a row off *p into field. Returns ',' when more
+// fields follow, '\n' at the end of the row or file, or 0 when the field
+// is malformed. Quoted fields are unescaped into the chunk's text.
+int next_field(ParseChunk *chunk, const char **p, Slice *field) {
+    const char *s = *p;
+    const char *end = chunk->end;
+
+    if (s < end && *s == '"') {
+        char *out = chunk->text + chunk->text_used;
+        int len = 0;
+        s++;
+        while (1) {
+            const char *q = memchr(s, '"', end - s);
+            if (!q) {
+                return 0;   // Unterminated quote
+            }
+            memcpy(out + len, s, q - s);
+            len += q - s;
+            for (const char *c = s; c < q; c++) {
+                chunk->lines += *c == '\n';
+            }
+            if (q + 1 < end && q[1] == '"') {
+                out[len++] = '"';
+                s = q + 2;
+            } else {
+                s = q + 1;
+                break;
+            }
+        }
+        out[len] = '\0';
+        chunk->text_used += len + 1;
+        field->text = out;
+        field->len = len;
+        field->quoted = 1;
+    } else {
+        const char *e = find_special(s, end);
+        // A quote inside an unquoted field is taken as it is
+        while (e < end && *e == '"') {
+            e = find_special(e + 1, end);
+        }
+        field->text = s;
+        field->len = e - s;
+        field->quoted = 0;
+        s = e;
+    }
+
+    if (s < end && *s == '\r' && (s + 1 == end || s[1] == '\n')) {
+        s++;
+    }
+    if (s == end) {
+        *p = s;
+        return '\n';
+    }
+    if (*s == ',' || *s == '\n') {
+        *p = s + 1;
+        return *s;
+    }
+    *p = s;
+    return 0;
+}
+
+// A field as an int, allowing surrounding spaces; 0 on success
+int parse_int(Slice field, int *out) {
+    const char *p = field.text, *end = field.text + field.len;
+    while (p < end && *p == ' ') p++;
+    while (end > p && end[-1] == ' ') end--;
+    int negative = p < end && *p == '-';
+    if (p < end && (*p == '-' || *p == '+')) p++;
+    if (p == end) {
+        return -1;
+    }
+    long long value = 0;
+    for (; p < end; p++) {
+        if (*p < '0' || *p > '9') {
+            return -1;
+        }
+        value = value * 10 + (*p - '0');
+        if (value > 2147483648LL) {
+            return -1;
+        }
+    }
+    if (negative) {
+        value = -value;
+    }
+    if (value > 2147483647LL) {
+        return -1;
+    }
+    *out = (int)value;
+    return 0;
+}
+
+// A field as a float. Plain decimals are built from an integer mantissa;
+// anything else, such as exponents, goes through strtof.
+int parse_float(Slice field, float *out) {
+    static const double powers[] = { 1, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9,
+                                     1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18 };
+    const char *p = field.text, *end = field.text + field.len;
+    while (p < end && *p == ' ') p++;
+    while (end > p && end[-1] == ' ') end--;
+    const char *start = p;
+    int negative = p < end && *p == '-';
+    if (p < end && (*p == '-' || *p == '+')) p++;
+
+    unsigned long long mantissa = 0;
+    int digits = 0, fraction = -1;
+    for (; p < end && digits < 18; p++) {
+        if (*p >= '0' && *p <= '9') {
+            mantissa = mantissa * 10 + (*p - '0');
+            digits++;
+            if (fraction >= 0) fraction++;
+        } else if (*p == '.' && fraction < 0) {
+            fraction = 0;
+        } else {
+            break;
+        }
+    }
+    if (p == end && digits > 0) {
+        double value = mantissa / powers[fraction > 0 ? fraction : 0];
+        *out = (float)(negative ? -value : value);
+        return 0;
+    }
+
+    char buf[64];
+    if (end - start == 0 || end - start >= (long)sizeof(buf)) {
+        return -1;
+    }
+    memcpy(buf, start, end - start);
+    buf[end - start] = '\0';
+    char *stop;
+    *out = strtof(buf, &stop);
+    return *stop == '\0' && isfinite(*out) ? 0 : -1;
+}
+
+// A string field, NUL-terminated in the chunk's text
+char *field_string(ParseChunk *chunk, Slice field) {
+    if (field.quoted) {
+        return (char *)field.text;
+    }
+    char *copy = chunk->text + chunk->text_used;
+    memcpy(copy, field.text, field.len);
+    copy[field.len] = '\0';
+    chunk->text_used += field.len + 1;
+    return copy;
+}
+
+void chunk_error(ParseChunk *chunk, int line, const char *message) {
+    if (chunk->num_errors < MAX_REPORTED_ERRORS) {
+        chunk->error_lines[chunk->num_errors] = line;
+        chunk->error_messages[chunk->num_errors] = message;
+    }
+    chunk->num_errors++;
+}
+
+// Parse every row of the chunk. Bad rows are recorded and skipped.
+void *parse_chunk(void *arg) {
+    ParseChunk *chunk = (ParseChunk *)arg;
+    const char *p = chunk->start;
+    size_t length = chunk->end - chunk->start;
+
+    chunk->text = malloc(length + 1);
+    chunk->rows_capacity = length / 24 + 16;
+    chunk->rows = malloc(chunk->rows_capacity * sizeof(ParsedRow));
+    if (!chunk->text || !chunk->rows) {
+        chunk->failed = 1;
+        return NULL;
+    }
+
+    while (p < chunk->end) {
+        int line = chunk->lines + 1;
+        if (*p == '\n' || (*p == '\r' && p + 1 < chunk->end && p[1] == '\n')) {
+            p += *p == '\r' ? 2 : 1;
+            chunk->lines++;
+            continue;
+        }
+
+        Slice fields[5];
+        int num_fields = 0;
+        int ended;
+        const char *error = NULL;
+        do {
+            if (num_fields == 5) {
+                error = "more than 5 fields";
+                break;
+            }
+            ended = next_field(chunk, &p, &fields[num_fields++]);
+            if (!ended) {
+                error = "bad quoting";
+                break;
+            }
+        } while (ended == ',');
+
+        ParsedRow row;
+        if (!error && num_fields != 5) {
+            error = "expected 5 fields";
+        } else if (!error && parse_int(fields[0], &row.id) != 0) {
+            error = "bad ID";
+        } else if (!error && parse_int(fields[2], &row.age) != 0) {
+            error = "bad age";
+        } else if (!error && parse_float(fields[4], &row.grade) != 0) {
+            error = "bad grade";
+        }
+
+        if (error) {
+            chunk_error(chunk, line, error);
+            if (ended != '\n') {
+                const char *newline = memchr(p, '\n', chunk->end - p);
+                p = newline ? newline + 1 : chunk->end;
+            }
+            chunk->lines++;
+            continue;
+        }
+        chunk->lines++;
+
+        row.name = field_string(chunk, fields[1]);
+        row.course = field_string(chunk, fields[3]);
+        if (chunk->num_rows == chunk->rows_capacity) {
+            ParsedRow *rows = realloc(chunk->rows, 2 * chunk->rows_capacity * sizeof(ParsedRow));
+            if (!rows) {
+                chunk->failed = 1;
+                return NULL;
+            }
+            chunk->rows = rows;
+            chunk->rows_capacity *= 2;
+        }
+        chunk->rows[chunk->num_rows++] = row;
+    }
+    return NULL;
+}
+
+// Cut [data, data + size) into parts that start on a row, never inside
+// a quoted field, by tracking quote parity up to each cut
+int split_chunks(const char *data, size_t size, int parts, ParseChunk *chunks) {
+    const char *end = data + size;
+    const char *pos = data;
+    long parity = 0;
+    int n = 0;
+
+    chunks[0].start = data;
+    for (int t = 1; t < parts; t++) {
+        const char *target = data + size / parts * t;
+        if (target <= pos) {
+            continue;
+        }
+        parity ^= count_quotes(pos, target) & 1;
+        pos = target;
+        const char *cut = NULL;
+        while (pos < end) {
+            const char *newline = memchr(pos, '\n', end - pos);
+            if (!newline) {
+                break;
+            }
+            parity ^= count_quotes(pos, newline) & 1;
+            pos = newline + 1;
+            if (parity == 0) {
+                cut = pos;
+                break;
+            }
+        }
+        if (!cut || cut == end) {
+            break;
+        }
+        chunks[n].end = cut;
+        chunks[++n].start = cut;
+    }
+    chunks[n].end = end;
+    return n + 1;
+}
+
+// Append parsed rows in file order, skipping ids already present
+void add_parsed_rows(ParseChunk *chunk, int *added, int *duplicates) {
+    for (int r = 0; r < chunk->num_rows; r++) {
+        ParsedRow *row = &chunk->rows[r];
+        if (find_student(row->id) != -1) {
+            (*duplicates)++;
+            continue;
+        }
+        if (append_student(row->id, row->name, row->age, row->course, row->grade) == -1) {
+            return;
+        }
+        (*added)++;
+    }
+}
+
+// Load every row of a CSV file: id,name,age,course,grade with optional
+// double quotes. The file is mapped and parsed in place; big files are
+// parsed by several threads, each on its own range of rows.
+int import_csv(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+    char *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    int threads = 1;
+    if (st.st_size >= PARALLEL_LOAD) {
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+        if (threads > MAX_SORT_THREADS) {
+            threads = MAX_SORT_THREADS;
+        }
+        if (threads < 1) {
+            threads = 1;
+        }
+    }
+    ParseChunk chunks[MAX_SORT_THREADS];
+    memset(chunks, 0, sizeof(chunks));
+    int num_chunks = split_chunks(data, st.st_size, threads, chunks);
+
+    pthread_t tids[MAX_SORT_THREADS];
+    int started = 0;
+    for (int c = 1; c < num_chunks; c++) {
+        if (pthread_create(&tids[c], NULL, parse_chunk, &chunks[c]) == 0) {
+            started |= 1 << c;
+        } else {
+            parse_chunk(&chunks[c]);
+        }
+    }
+    parse_chunk(&chunks[0]);
+    for (int c = 1; c < num_chunks; c++) {
+        if (started & (1 << c)) {
+            pthread_join(tids[c], NULL);
+        }
+    }
+
+    // Size the columns and the index once rather than growing row by row
+    long total = 0;
+    for (int c = 0; c < num_chunks; c++) {
+        total += chunks[c].num_rows;
+    }
+    reserve_students(students.count + total);
+    if ((id_index.used + total) * 2 > 1L << id_index.bits) {
+        index_rebuild(id_index.used + total);
+    }
+    // Inserting many rows one by one into a view costs more than sorting
+    int rebuild_views = total > students.count / 8;
+    if (rebuild_views) {
+        for (int v = 0; v < num_views; v++) {
+            views[v]->count = -1;
+        }
+    }
+
+    int added = 0, duplicates = 0, errors = 0, failed = 0, line = 0;
+    for (int c = 0; c < num_chunks; c++) {
+        ParseChunk *chunk = &chunks[c];
+        for (int e = 0; e < chunk->num_errors && e < MAX_REPORTED_ERRORS; e++) {
+            if (errors + e < MAX_REPORTED_ERRORS) {
+                printf("%s:%d: %s\n", path, line + chunk->error_lines[e], chunk->error_messages[e]);
+            }
+        }
+        errors += chunk->num_errors;
+        line += chunk->lines;
+        failed |= chunk->failed;
+        if (!chunk->failed) {
+            add_parsed_rows(chunk, &added, &duplicates);
+        }
+        free(chunk->rows);
+        free(chunk->text);
+    }
+    munmap(data, st.st_size);
+
+    if (rebuild_views) {
+        for (int v = 0; v < num_views; v++) {
+            if (build_view(views[v]) != 0 && current_view == views[v]) {
+                current_view = NULL;
+            }
+        }
+    }
+    if (failed) {
+        printf("Out of memory while reading %s.\n", path);
+    }
+    if (errors > 0) {
+        printf("Skipped %d rows with errors.\n", errors);
+    }
+    if (duplicates > 0) {
+        printf("Skipped %d records with an ID already loaded.\n", duplicates);
+    }
+    return added;
+}
+
+int flush_writer(CsvWriter *w) {
+    size_t done = 0;
+    while (done < w->len) {
+        ssize_t n = write(w->fd, w->buf + done, w->len - done);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        done += n;
+    }
+    w->len = 0;
+    return 0;
+}
+
+void put_int(CsvWriter *w, long long value) {
+    char digits[24];
+    int n = 0;
+    unsigned long long v = value < 0 ? 0ULL - (unsigned long long)value : (unsigned long long)value;
+    do {
+        digits[n++] = '0' + v % 10;
+        v /= 10;
+    } while (v);
+    if (value < 0) {
+        w->buf[w->len++] = '-';
+    }
+    while (n > 0) {
+        w->buf[w->len++] = digits[--n];
+    }
+}
+
+// Grades with two decimals, exactly as %.2f prints them. A float times
+// 100 is exact in a double, so rounding it to the nearest integer agrees
+// with printf except on exact ties, which printf rounds to even. Ties,
+// negative numbers (including -0.0) and huge values go through snprintf.
+void put_grade(CsvWriter *w, float grade) {
+    double scaled = (double)grade * 100.0;
+    long long cents = (long long)(scaled >= 0 && scaled < 1e15 ? scaled : 0);
+    if (!(scaled >= 0 && scaled < 1e15) || signbit(grade) || scaled - cents == 0.5) {
+        char text[64];
+        int n = snprintf(text, sizeof(text), "%.2f", grade);
+        memcpy(w->buf + w->len, text, n);
+        w->len += n;
+        return;
+    }
+    cents += scaled - cents > 0.5;
+    put_int(w, cents / 100);
+    w->buf[w->len++] = '.';
+    w->buf[w->len++] = '0' + cents / 10 % 10;
+    w->buf[w->len++] = '0' + cents % 10;
+}
+
+// A string field, quoted when it holds a delimiter or a quote
+int put_string(CsvWriter *w, const char *s) {
+    size_t len = strlen(s);
+    int quote = find_special(s, s + len) != s + len;
+    size_t need = quote ? 2 * len + 2 : len;
+    if (w->len + need + 64 > WRITE_BUFFER && flush_writer(w) != 0) {
+        return -1;
+    }
+    if (need + 64 > WRITE_BUFFER) {
+        return -1;
+    }
+    if (!quote) {
+        memcpy(w->buf + w->len, s, len);
+        w->len += len;
+        return 0;
+    }
+    w->buf[w->len++] = '"';
+    for (const char *c = s; *c; c++) {
+        if (*c == '"') {
+            w->buf[w->len++] = '"';
+        }
+        w->buf[w->len++] = *c;
+    }
+    w->buf[w->len++] = '"';
+    return 0;
+}
+
+// Open a temporary file next to path; the caller renames it over path
+// once it is complete, so a crash never leaves a half-written file
+int open_writer(CsvWriter *w, const char *path, char *tmp, size_t size) {
+    if (snprintf(tmp, size, "%s.tmp", path) >= (int)size) {
+        return -1;
+    }
+    w->buf = malloc(WRITE_BUFFER);
+    w->len = 0;
+    w->fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (!w->buf || w->fd == -1) {
+        free(w->buf);
+        if (w->fd != -1) {
+            close(w->fd);
+            unlink(tmp);
+        }
+        return -1;
+    }
+    return 0;
+}
+
+// Flush, sync and close the temporary file, then move it over path
+int close_writer(CsvWriter *w, int status, const char *tmp, const char *path) {
+    if (status == 0) {
+        status = flush_writer(w);
+    }
+    if (status == 0 && fsync(w->fd) != 0) {
+        status = -1;
+    }
+    if (close(w->fd) != 0) {
+        status = -1;
+    }
+    free(w->buf);
+    if (status == 0 && rename(tmp, path) != 0) {
+        status = -1;
+    }
+    if (status != 0) {
+        unlink(tmp);
+    }
+    return status;
+}
+
+// Write every student as CSV, in the current sort order, through one
+// large buffer
+int export_csv(const char *path) {
+    CsvWriter w;
+    char tmp[512];
+    if (open_writer(&w, path, tmp, sizeof(tmp)) != 0) {
+        return -1;
+    }
+
+    // Each put_string leaves 64 bytes free for the numbers after it; on
+    // any failure stop before writing into the buffer again
+    const int *order = current_order();
+    int status = 0;
+    for (int n = 0; n < students.count; n++) {
+        int i = order ? order[n] : n;
+        if (w.len + 64 > WRITE_BUFFER && flush_writer(&w) != 0) {
+            status = -1;
+            break;
+        }
+        put_int(&w, students.ids[i]);
+        w.buf[w.len++] = ',';
+        if (put_string(&w, string_at(students.names[i])) != 0) {
+            status = -1;
+            break;
+        }
+        w.buf[w.len++] = ',';
+        put_int(&w, students.ages[i]);
+        w.buf[w.len++] = ',';
+        if (put_string(&w, string_at(students.courses[i])) != 0) {
+            status = -1;
+            break;
+        }
+        w.buf[w.len++] = ',';
+        put_grade(&w, students.grades[i]);
+        w.buf[w.len++] = '\n';
+    }
+    return close_writer(&w, status, tmp, path);
+}
+
+// 64-bit hash of size bytes (a multiple of 8), four words at a time in
+// independent lanes so the multiplies overlap
+unsigned long long checksum(const char *data, size_t size) {
+    const unsigned long long prime1 = 0x9E3779B185EBCA87ULL, prime2 = 0xC2B2AE3D27D4EB4FULL;
+    unsigned long long lanes[4] = { prime1, prime2, ~prime1, ~prime2 };
+    size_t words = size / 8, i = 0;
+    for (; i + 4 <= words; i += 4) {
+        for (int l = 0; l < 4; l++) {
+            unsigned long long w;
+            memcpy(&w, data + (i + l) * 8, 8);
+            lanes[l] += w * prime2;
+            lanes[l] = (lanes[l] << 31 | lanes[l] >> 33) * prime1;
+        }
+    }
+    unsigned long long h = size;
+    for (int l = 0; l < 4; l++) {
+        h = (h ^ lanes[l]) * prime1;
+    }
+    for (; i < words; i++) {
+        unsigned long long w;
+        memcpy(&w, data + i * 8, 8);
+        h = (h ^ w * prime2) * prime1;
+    }
+    h ^= h >> 29;
+    h *= prime2;
+    return h ^ h >> 32;
+}
+
+int put_bytes(CsvWriter *w, const void *data, size_t size) {
+    if (size == 0) {
+        return 0;
+    }
+    if (w->len + size > WRITE_BUFFER && flush_writer(w) != 0) {
+        return -1;
+    }
+    if (size > WRITE_BUFFER) {
+        CsvWriter direct = { w->fd, (char *)data, size };
+        return flush_writer(&direct);
+    }
+    memcpy(w->buf + w->len, data, size);
+    w->len += size;
+    return 0;
+}
+
+// Pad the file to the next multiple of 8 bytes
+int put_padding(CsvWriter *w, size_t *offset) {
+    static const char zeros[8];
+    size_t pad = -*offset & 7;
+    *offset += pad;
+    return put_bytes(w, zeros, pad);
+}
+
+// One 4-byte column with its rows in the given order
+int put_column(CsvWriter *w, const void *column, const int *order, int count) {
+    const char *base = column;
+    for (int n = 0; n < count; n++) {
+        if (w->len + 4 > WRITE_BUFFER && flush_writer(w) != 0) {
+            return -1;
+        }
+        memcpy(w->buf + w->len, base + 4 * (size_t)(order ? order[n] : n), 4);
+        w->len += 4;
+    }
+    return 0;
+}
+
+void section_sizes(const SnapshotHeader *header, unsigned long long *sizes) {
+    sizes[SECTION_IDS] = header->count * sizeof(int);
+    sizes[SECTION_AGES] = header->count * sizeof(int);
+    sizes[SECTION_GRADES] = header->count * sizeof(float);
+    sizes[SECTION_NAMES] = header->count * sizeof(int);
+    sizes[SECTION_COURSES] = header->count * sizeof(int);
+    sizes[SECTION_OFFSETS] = header->num_strings * sizeof(unsigned long long);
+    sizes[SECTION_PREFIXES] = header->num_strings * sizeof(unsigned long long);
+    sizes[SECTION_TEXT] = header->text_size;
+    sizes[SECTION_SLOTS] = header->index_slots * sizeof(IndexSlot);
+    sizes[SECTION_TABLE] = header->table_size * sizeof(int);
+}
+
+// Write the whole store as a snapshot, rows in the current sort order.
+// The file is written with a zero checksum, read back through a mapping
+// to compute it, and only renamed into place once complete and synced.
+int save_snapshot(const char *path) {
+    int count = students.count;
+    const int *order = current_order();
+    int *position = NULL;   // Row -> row in the snapshot
+    if (order) {
+        position = malloc((count ? count : 1) * sizeof(int));
+        if (!position) {
+            return -1;
+        }
+        for (int n = 0; n < count; n++) {
+            position[order[n]] = n;
+        }
+    }
+
+    SnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.header_size = sizeof(header);
+    header.count = count;
+    header.num_strings = strings.num_strings;
+    header.table_size = strings.table_size;
+    header.index_bits = id_index.bits;
+    header.index_slots = id_index.slots ? 1 << id_index.bits : 0;
+    header.index_used = id_index.used;
+    header.text_size = strings.text_used;
+    unsigned long long sizes[NUM_SECTIONS];
+    section_sizes(&header, sizes);
+    size_t offset = sizeof(header);
+    for (int i = 0; i < NUM_SECTIONS; i++) {
+        header.sections[i] = offset;
+        offset = (offset + sizes[i] + 7) & ~(size_t)7;
+    }
+    header.file_size = offset;
+
+    CsvWriter w;
+    char tmp[512];
+    if (open_writer(&w, path, tmp, sizeof(tmp)) != 0) {
+        free(position);
+        return -1;
+    }
+    const void *columns[] = { students.ids, students.ages, students.grades,
+                              students.names, students.courses };
+    const void *arrays[NUM_SECTIONS] = {
+        [SECTION_OFFSETS] = strings.offsets,
+        [SECTION_PREFIXES] = strings.prefixes,
+        [SECTION_TEXT] = strings.text,
+        [SECTION_TABLE] = strings.table,
+    };
+    int status = put_bytes(&w, &header, sizeof(header));
+    offset = sizeof(header);
+    for (int i = 0; i < NUM_SECTIONS && status == 0; i++) {
+        if (i <= SECTION_COURSES) {
+            status = put_column(&w, columns[i], order, count);
+        } else if (i == SECTION_SLOTS) {
+            for (int s = 0; s < header.index_slots && status == 0; s++) {
+                IndexSlot slot = id_index.slots[s];
+                if (position && slot.row != -1) {
+                    slot.row = position[slot.row];
+                }
+                status = put_bytes(&w, &slot, sizeof(slot));
+            }
+        } else {
+            status = put_bytes(&w, arrays[i], sizes[i]);
+        }
+        offset += sizes[i];
+        status |= put_padding(&w, &offset);
+    }
+    free(position);
+    if (status == 0) {
+        status = flush_writer(&w);
+    }
+
+    if (status == 0) {
+        char *data = mmap(NULL, header.file_size, PROT_READ, MAP_SHARED, w.fd, 0);
+        if (data == MAP_FAILED) {
+            status = -1;
+        } else {
+            header.checksum = checksum(data + sizeof(header), header.file_size - sizeof(header));
+            munmap(data, header.file_size);
+            if (pwrite(w.fd, &header, sizeof(header), 0) != sizeof(header)) {
+                status = -1;
+            }
+        }
+    }
+    return close_writer(&w, status, tmp, path);
+}
+
+// Map a snapshot and use it as the store, with no parsing: the columns,
+// pool and index point straight into the mapping. The mapping is private,
+// so edits copy the pages they touch and the file itself stays as saved.
+// Returns the number of students, or -1 when there is no usable snapshot.
+int load_snapshot(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(SnapshotHeader)) {
+        close(fd);
+        printf("%s is not a snapshot.\n", path);
+        return -1;
+    }
+    char *data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+
+    SnapshotHeader header;
+    memcpy(&header, data, sizeof(header));
+    const char *problem = NULL;
+    if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0) {
+        problem = "is not a snapshot";
+    } else if (header.version != SNAPSHOT_VERSION || header.header_size != sizeof(header)) {
+        problem = "was saved by another version";
+    } else if (header.file_size != (unsigned long long)st.st_size || header.file_size % 8 != 0) {
+        problem = "is truncated";
+    } else if (checksum(data + sizeof(header), header.file_size - sizeof(header)) != header.checksum) {
+        problem = "is corrupt (checksum mismatch)";
+    }
+
+    unsigned long long sizes[NUM_SECTIONS];
+    section_sizes(&header, sizes);
+    if (!problem) {
+        if (header.count < 0 || header.num_strings < 0 || header.table_size < 0 ||
+            header.index_slots < 0 || header.index_bits < 0 || header.index_bits > 30 ||
+            (header.index_slots != 0 && header.index_slots != 1 << header.index_bits) ||
+            (header.table_size & (header.table_size - 1)) != 0) {
+            problem = "has an invalid header";
+        }
+        for (int i = 0; i < NUM_SECTIONS && !problem; i++) {
+            if (header.sections[i] % 8 != 0 || header.sections[i] > header.file_size ||
+                sizes[i] > header.file_size - header.sections[i]) {
+                problem = "has an invalid header";
+            }
+        }
+        if (!problem && header.text_size > 0 &&
+            data[header.sections[SECTION_TEXT] + header.text_size - 1] != '\0') {
+            problem = "has an invalid header";
+        }
+    }
+    if (problem) {
+        printf("%s %s; loading students.txt instead.\n", path, problem);
+        munmap(data, st.st_size);
+        return -1;
+    }
+
+    // Empty sections stay NULL, as they would be in a fresh store
+    void *at[NUM_SECTIONS];
+    for (int i = 0; i < NUM_SECTIONS; i++) {
+        at[i] = sizes[i] ? data + header.sections[i] : NULL;
+    }
+    students.ids = at[SECTION_IDS];
+    students.ages = at[SECTION_AGES];
+    students.grades = at[SECTION_GRADES];
+    students.names = at[SECTION_NAMES];
+    students.courses = at[SECTION_COURSES];
+    students.count = students.capacity = header.count;
+    strings.text = at[SECTION_TEXT];
+    strings.text_used = strings.text_capacity = header.text_size;
+    strings.offsets = at[SECTION_OFFSETS];
+    strings.prefixes = at[SECTION_PREFIXES];
+    strings.num_strings = strings.strings_capacity = header.num_strings;
+    strings.table = at[SECTION_TABLE];
+    strings.table_size = header.table_size;
+    id_index.slots = at[SECTION_SLOTS];
+    id_index.bits = header.index_bits;
+    id_index.used = header.index_used;
+    snapshot = data;
+    snapshot_size = st.st_size;
+    return header.count;
+}
+
+void import_students() {
+    char path[256];
+    get_line("File to import: ", path, sizeof(path));
+    int before = students.count;
+    if (import_csv(path) == -1) {
+        printf("Error reading %s.\n", path);
+        return;
+    }
+    printf("Imported %d students.\n", students.count - before);
+}
+
+void export_students() {
+    char path[256];
+    get_line("File to export to: ", path, sizeof(path));
+    if (export_csv(path) != 0) {
+        printf("Error writing %s.\n", path);
+        return;
+    }
+    printf("Exported %d students.\n", students.count);
+}
+
+// students.txt stays the readable copy; the snapshot, written after it,
+// is what the next start loads
+void save_to_file() {
+    if (export_csv("students.txt") != 0) {
+        printf("Error saving to file.\n");
+    }
+    if (save_snapshot(SNAPSHOT_FILE) != 0) {
+        printf("Error saving %s.\n", SNAPSHOT_FILE);
+    }
+}
+
+// Start from the snapshot unless students.txt was changed after it
+void load_from_file() {
+    struct stat snap, text;
+    if (stat(SNAPSHOT_FILE, &snap) == 0) {
+        int newer_text = stat("students.txt", &text) == 0 &&
+            (text.st_mtim.tv_sec > snap.st_mtim.tv_sec ||
+             (text.st_mtim.tv_sec == snap.st_mtim.tv_sec &&
+              text.st_mtim.tv_nsec > snap.st_mtim.tv_nsec));
+        if (!newer_text && load_snapshot(SNAPSHOT_FILE) != -1) {
+            return;
+        }
+    }
+    import_csv("students.txt");
+}
+
+int main() {
+    load_from_file();
+    int choice;
+
+    do {
+        printf("\n--- Student Management System ---\n");
+        printf("1. Add Student\n");
+        printf("2. View Students\n");
+        printf("3. Search Student\n");
+        printf("4. Update Student\n");
+        printf("5. Delete Student\n");
+        printf("6. Sort Students\n");
+        printf("7. Grade Statistics\n");
+        printf("8. Import Students from CSV\n");
+        printf("9. Export Students to CSV\n");
+        printf("10. Save & Exit\n");
+
+        choice = get_valid_int("Enter your choice: ");
+
+        switch (choice) {
+            case 1: add_student(); break;
+            case 2: display_students(); break;
+            case 3: search_student(); break;
+            case 4: update_student(); break;
+            case 5: delete_student(); break;
+            case 6: sort_students(); break;
+            case 7: grade_statistics(); break;
+            case 8: import_students(); break;
+            case 9: export_students(); break;
+            case 10:
+                save_to_file();
+                printf("Data saved. Exiting...\n");
+                break;
+            default: printf("Invalid choice.\n");
+        }
+    } while (choice != 10);
+
+    return 0;
+}
@@ -0,0 +1,73 @@
+#!/usr/bin/env python3
+# Local HTTP/1.1 server for bench_scraper.sh:
+#   bench_server.py port [delay_ms]
+# /site/N is page N of a generated site of SITE_PAGES linked pages for
+# crawl runs; every other path answers with the same 4 KB page. Each
+# connection is handled
+# on its own thread and sleeps delay_ms before answering, standing in for
+# the round trip to a remote site, so overlapping transfers pay off the
+# way they would against real servers.
+
+import sys
+import time
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+PAGE = b"<html><body>" + b"x" * 4000 + b"</body></html>\n"
+
+# The site is a tree with FANOUT children per page, 1 + 10 + ... + 100000
+# pages, so a crawl from /site/0 reaches all of them by depth 5. Each page
+# also links back to its parent, the root and one page elsewhere in the
+# site, so most links found are ones the seen-set already holds.
+SITE_PAGES = 111111
+FANOUT = 10
+
+
+def site_page(n):
+    links = [n * FANOUT + i for i in range(1, FANOUT + 1)]
+    links = [child for child in links if child < SITE_PAGES]
+    links += [(n - 1) // FANOUT if n > 0 else 0, 0, n * 7919 % SITE_PAGES]
+    body = "".join('<a href="/site/%d">%d</a>\n' % (link, link) for link in links)
+    return ("<html><body>\n%s</body></html>\n" % body).encode()
+
+
+class Handler(BaseHTTPRequestHandler):
+    # Keep-alive, so the scraper's connection reuse can be measured; every
+    # answer carries Content-Length. Headers and body go out in separate
+    # writes, which Nagle would hold back for the client's delayed ACK.
+    protocol_version = "HTTP/1.1"
+    disable_nagle_algorithm = True
+
+    def do_GET(self):
+        if self.server.delay > 0:
+            time.sleep(self.server.delay)
+        page = PAGE
+        if self.path.startswith("/site/"):
+            n = self.path[len("/site/"):]
+            if not n.isdigit() or int(n) >= SITE_PAGES:
+                self.send_error(404)
+                return
+            page = site_page(int(n))
+        self.send_response(200)
+        self.send_header("Content-Type", "text/html")
+        self.send_header("Content-Length", str(len(page)))
+        self.end_headers()
+        self.wfile.write(page)
+
+    def log_message(self, format, *args):
+        pass
+
+
+class Server(ThreadingHTTPServer):
+    daemon_threads = True
+    request_queue_size = 1024   # Room for every connection a run opens at once
+
+
+def main():
+    port = int(sys.argv[1])
+    server = Server(("127.0.0.1", port), Handler)
+    server.delay = float(sys.argv[2]) / 1000 if len(sys.argv) > 2 else 0
+    server.serve_forever()
+
+
+if __name__ == "__main__":
+    main()
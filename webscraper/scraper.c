@@ -1,98 +1,3410 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <pthread.h>
 #include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <ctype.h>
+#include <stdarg.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
 #include <curl/curl.h>
+#include <zlib.h>
 
-#define MAX_URLS 100
+#define QUEUE_CAPACITY 4096
+#define MAX_EVENTS 256
+#define HOST_BUCKETS 4096
+#define MAX_ATTEMPTS 4
+#define MAX_BACKOFF 60.0
+#define RETRY_BASE 0.5          // First retry of a failed transfer, in seconds
+#define HEDGE_MIN_SAMPLES 20    // Responses from a host before hedging it
+#define HEDGE_BUDGET 10         // At most one hedge per this many transfers
+#define MAX_STAGES 8
+#define MAX_LINK_LENGTH 2048
+#define SUMMARY_LENGTH 512
+#define SEEN_SHARDS 256
+#define BLOOM_HASHES 7
+#define STORE_BUFFER (1 << 20)
+#define SEGMENT_SIZE (256L << 20)
+#define CACHE_BUCKETS 65536
+#define HIST_SUB_BITS 5         // 32 buckets per power of two, about 3% error
+#define HOST_HIST_SUB_BITS 3    // Per-host histograms: 8, about 12% error
+#define HIST_MAX_BITS 40        // Microseconds, so up to about 12 days
+#define METRIC_BUCKETS 256
+#define SLOWEST_HOSTS 20
 
+struct Host;
+struct Histogram;
+
+// One URL waiting to be fetched; index picks its output_N.txt
+typedef struct UrlItem {
+    char *url;
+    long index;
+    int depth;              // Links followed from a seed URL to reach it
+    struct Host *host;
+    int attempts;
+    double retry_at;        // When a deferred retry may go
+    struct UrlItem *next;
+} UrlItem;
+
+// Politeness state for one host:port. Hosts with URLs waiting sit on a
+// ring that is served round-robin, so no single host can fill the pipeline.
+typedef struct Host {
+    char *key;
+    int active;             // Transfers in flight
+    double tokens;          // Token bucket for the request rate
+    double refilled_at;
+    double blocked_until;   // Retry-After or 429 backoff
+    double backoff;         // Next backoff without Retry-After
+    UrlItem *pending;       // FIFO of waiting URLs
+    UrlItem *pending_tail;
+    struct Host *ring_next;
+    struct Host *ring_prev;
+    int on_ring;
+    struct Histogram *ttfb; // Time to first byte, with -E
+    double hedge_after;     // Hedge a transfer after this long, 0 for never
+    struct Host *next;      // Hash chain
+} Host;
+
+// Groups URLs by host in front of the fetch step. The reader blocks when
+// QUEUE_CAPACITY URLs are waiting, so memory stays bounded.
+typedef struct {
+    Host *buckets[HOST_BUCKETS];
+    Host *cursor;           // Next host on the ring to serve
+    int pending;            // URLs waiting across all hosts
+    int active;             // URLs handed out and not yet finished
+    int closed;             // No more URLs will be pushed
+    UrlItem *delayed;       // Failed URLs backing off, soonest first
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} Scheduler;
+
+// A body's record in the store: segment-N.warc, from offset for len bytes
+typedef struct {
+    int segment;            // -1 for none
+    long long offset;
+    size_t len;
+    int gzip;
+} StoreRecord;
+
+// A streaming stage that sees every chunk of a body as curl delivers it.
+// open returns the stage's state (NULL on error), write returns -1 to
+// abort the transfer, and close appends a note about the result (the
+// store stage also says where the body went). abort throws away an
+// attempt that will be retried, leaving no output.
+typedef struct {
+    const char *name;
+    void *(*open)(UrlItem *item);
+    int (*write)(void *state, const char *data, size_t len);
+    void (*close)(void *state, char *summary, size_t cap, StoreRecord *stored);
+    void (*abort)(void *state);
+    int success_only;       // Abort instead of close unless the response was 2xx
+} Processor;
+
+// The stages configured with -p, instantiated for one transfer. Stages
+// are opened by the first chunk, so a 304 leaves earlier outputs alone.
+typedef struct ContentPipeline {
+    UrlItem *item;
+    int opened;
+    int num_stages;
+    void *states[MAX_STAGES];
+    size_t bytes;
+    unsigned long long hash;    // FNV-1a of the body, kept with -C
+    StoreRecord stored;         // Filled in by the store stage
+    char etag[256];             // Validators of the final response
+    char last_modified[64];
+    struct curl_slist *headers; // If-None-Match / If-Modified-Since
+    struct ContentPipeline *rival;  // The other copy of a hedged request
+} ContentPipeline;
+
+// What an earlier run learned about a URL, for conditional requests
+typedef struct CacheEntry {
+    char *url;
+    char *etag;             // Empty when the server sent none
+    char *last_modified;
+    unsigned long long hash;
+    StoreRecord stored;     // Where the body went, if the store kept it
+    struct CacheEntry *next;
+} CacheEntry;
+
+// Incremental href extractor, fed chunk by chunk. A partial match is
+// carried across chunk boundaries.
+typedef enum {
+    LINK_SCAN,          // Looking for "href"
+    LINK_NAME,          // After href, waiting for =
+    LINK_EQUALS,        // After =, waiting for the value
+    LINK_VALUE          // Inside the value
+} LinkPhase;
+
+typedef struct {
+    LinkPhase phase;
+    int matched;        // Characters of "href" seen so far
+    char quote;         // Closing quote, or 0 for an unquoted value
+    char value[MAX_LINK_LENGTH];
+    size_t len;
+    int overflow;       // Value too long; dropped
+} LinkScanner;
+
+// Which discovered links a crawl may follow
+typedef enum {
+    DOMAIN_SAME_HOST,   // Only the host of the page they were found on
+    DOMAIN_SUFFIX,      // Hosts ending in config.domain
+    DOMAIN_ANY
+} DomainLimit;
+
+// One lock-protected slice of the seen-set. URLs are kept as 64-bit
+// fingerprints in open addressing; 0 marks an empty slot.
+typedef struct {
+    pthread_mutex_t lock;
+    unsigned long long *slots;
+    size_t cap;
+    size_t count;
+} SeenShard;
+
+// One thread's share of the record store. Every thread appends to its
+// own segment through its own buffer, so writers never contend.
+typedef struct StoreWriter {
+    int fd;
+    FILE *index;            // segment-N.idx, one line per record
+    int segment;
+    off_t offset;           // Logical end of the segment, buffer included
+    char *buf;
+    size_t buf_len;
+    struct StoreWriter *next;
+} StoreWriter;
+
+// Phases of a transfer, from curl_easy_getinfo
+typedef enum {
+    TIME_DNS,
+    TIME_CONNECT,
+    TIME_TLS,
+    TIME_TTFB,
+    TIME_TOTAL,
+    NUM_TIMINGS
+} Timing;
+
+// Log-linear latency histogram in microseconds, in the style of
+// HdrHistogram: exact below 2^sub_bits us, then 2^sub_bits buckets per
+// power of two. The counts are allocated by the first value recorded, so
+// phases a host never goes through (TLS on plain HTTP) cost nothing.
+typedef struct Histogram {
+    int sub_bits;
+    unsigned int *counts;
+    long total;
+    long long sum;
+    long long max;
+} Histogram;
+
+// What one thread saw of one host. Status 0 counts transport errors.
+// Per-host histograms are coarse, since there can be one per host per
+// thread; the all-hosts totals are kept at full precision on their own.
+typedef struct HostMetrics {
+    struct Host *host;
+    long requests;
+    long status[6];
+    long long bytes;
+    Histogram timings[NUM_TIMINGS];
+    struct HostMetrics *next;
+} HostMetrics;
+
+// Each thread records into its own table without locking; the tables
+// are merged once the fetch threads are done
+typedef struct MetricsTable {
+    HostMetrics *buckets[METRIC_BUCKETS];
+    HostMetrics *all;       // Every host, full precision
+    struct MetricsTable *next;
+} MetricsTable;
+
+// How transfers are driven
+typedef enum {
+    ENGINE_THREADS,     // Worker pool, one blocking transfer per thread
+    ENGINE_MULTI        // One thread, curl_multi socket actions over epoll
+} Engine;
+
+typedef struct {
+    char *urls_file;
+    int workers;
+    Engine engine;
+    int concurrency;    // Transfers in flight at once with ENGINE_MULTI
+    int fresh;          // New handle and connection for every URL
+    int per_host;       // Transfers in flight per host, 0 for no limit
+    double rate;        // Requests per second per host, 0 for no limit
+    int honor_retry;    // Back off on 429/503 and Retry-After
+    const Processor *stages[MAX_STAGES];
+    int num_stages;
+    int max_depth;      // Follow links this deep; 0 fetches only the list
+    DomainLimit domain_limit;
+    char *domain;       // Suffix for DOMAIN_SUFFIX
+    long max_pages;     // Stop queueing new URLs after this many, 0 for no limit
+    long bloom_mb;      // Seen-set as a Bloom filter of this size, 0 for exact
+    char *store_dir;    // Where the store stage puts its segments
+    int store_gzip;     // Compress each stored record
+    char *cache_file;   // Validators from earlier runs, NULL for none
+    char *metrics_file; // Timings as JSON (*.json) or Prometheus text
+    long connect_timeout;   // Seconds, 0 for curl's default
+    long total_timeout;     // Seconds, 0 for no limit
+    long low_speed_limit;   // Abort below this many bytes/sec...
+    long low_speed_time;    // ...sustained for this many seconds
+    int max_attempts;       // Tries per URL for transient failures
+    double hedge_percentile;    // Duplicate slow requests, 0 for never
+} Config;
+
+// A transfer in flight. With hedging a duplicate may run beside it; the
+// first to answer keeps the pipeline and the other is cancelled.
+typedef struct Transfer {
+    CURL *curl;
+    ContentPipeline *content;
+    UrlItem *item;
+    double hedge_at;        // When to send the duplicate, 0 for never
+    CURL *hedge;
+    ContentPipeline *hedge_content;
+    struct Transfer *next;  // Event loop's in-flight list
+    struct Transfer *prev;
+} Transfer;
+
+// A pool worker's handles, kept for its whole life
+typedef struct {
+    CURL *curl;
+    CURL *spare;            // For hedged duplicates
+    CURLM *multi;           // Drives both copies of a hedged request
+} FetchWorker;
+
+// State shared with the curl_multi socket and timer callbacks
+typedef struct {
+    CURLM *multi;
+    int epoll_fd;
+    long timeout_ms;    // From the timer callback, -1 for none
+    CURL **idle;        // Finished easy handles kept for the next URL
+    int num_idle;
+    Transfer *transfers;    // In flight, for the hedge timer
+} EventLoop;
+
+Scheduler sched;
+Config config;
+long fetched_count = 0;
+long failed_count = 0;
+long connections_opened = 0;
+long connections_reused = 0;
+long long bytes_downloaded = 0;
+long retries = 0;
+long hedges_sent = 0;
+long hedges_won = 0;
+pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Per-thread transfer metrics
+__thread MetricsTable *thread_metrics = NULL;
+MetricsTable *metrics_tables = NULL;
+pthread_mutex_t metrics_lock = PTHREAD_MUTEX_INITIALIZER;
+const char *timing_names[NUM_TIMINGS] = { "dns", "connect", "tls", "ttfb", "total" };
+
+// Conditional re-fetch cache, loaded from and saved back to -C
+CacheEntry *cache_buckets[CACHE_BUCKETS];
+pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+long cache_hits = 0;        // 304 Not Modified
+long cache_misses = 0;      // Body downloaded
+
+// Record store writers, one per thread that has stored something
+__thread StoreWriter *thread_writer = NULL;
+StoreWriter *store_writers = NULL;
+int store_segments = 0;
+pthread_mutex_t store_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// URLs handed out so far; discovered links are numbered after the seeds
+long url_total = 0;
+
+// Crawl deduplication. Each shard has its own mutex, and the Bloom filter
+// needs no lock at all, so fetch threads never serialize on one lock.
+SeenShard seen_shards[SEEN_SHARDS];
+unsigned long long *bloom_bits = NULL;
+size_t bloom_nbits = 0;
+
+// DNS cache, TLS sessions and the connection pool, shared by every handle
+CURLSH *share = NULL;
+pthread_mutex_t share_locks[CURL_LOCK_DATA_LAST];
+
+char *next_url(FILE *fp);
+
+double now_seconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void sched_init(Scheduler *s) {
+    memset(s->buckets, 0, sizeof(s->buckets));
+    s->cursor = NULL;
+    s->pending = 0;
+    s->active = 0;
+    s->closed = 0;
+    s->delayed = NULL;
+    pthread_mutex_init(&s->lock, NULL);
+
+    // Timed waits for a rate-limited host use the monotonic clock
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&s->changed, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+// host:port of url; every URL curl can't parse shares the "" host
+char *host_key(char *url) {
+    CURLU *h = curl_url();
+    char *host = NULL, *port = NULL;
+    char *key;
+
+    if (h && curl_url_set(h, CURLUPART_URL, url, CURLU_GUESS_SCHEME) == CURLUE_OK &&
+        curl_url_get(h, CURLUPART_HOST, &host, 0) == CURLUE_OK &&
+        curl_url_get(h, CURLUPART_PORT, &port, CURLU_DEFAULT_PORT) == CURLUE_OK) {
+        key = malloc(strlen(host) + strlen(port) + 2);
+        if (key) {
+            sprintf(key, "%s:%s", host, port);
+        }
+    } else {
+        key = strdup("");
+    }
+    curl_free(host);
+    curl_free(port);
+    curl_url_cleanup(h);
+
+    if (!key) {
+        fprintf(stderr, "Memory allocation error\n");
+        exit(1);
+    }
+    return key;
+}
+
+Host *find_host(Scheduler *s, char *key) {
+    unsigned long hash = 5381;
+    for (char *c = key; *c; c++) {
+        hash = hash * 33 + (unsigned char)*c;
+    }
+    Host **bucket = &s->buckets[hash % HOST_BUCKETS];
+
+    for (Host *host = *bucket; host != NULL; host = host->next) {
+        if (strcmp(host->key, key) == 0) {
+            free(key);
+            return host;
+        }
+    }
+
+    Host *host = calloc(1, sizeof(Host));
+    if (!host) {
+        fprintf(stderr, "Memory allocation error\n");
+        exit(1);
+    }
+    host->key = key;
+    host->tokens = config.rate < 1 ? 1 : config.rate;
+    host->refilled_at = now_seconds();
+    host->backoff = 1.0;
+    host->next = *bucket;
+    *bucket = host;
+    return host;
+}
+
+void ring_insert(Scheduler *s, Host *host) {
+    if (host->on_ring) {
+        return;
+    }
+    host->on_ring = 1;
+    if (s->cursor == NULL) {
+        host->ring_next = host->ring_prev = host;
+        s->cursor = host;
+        return;
+    }
+    // Just behind the cursor, so it is served after every waiting host
+    host->ring_next = s->cursor;
+    host->ring_prev = s->cursor->ring_prev;
+    host->ring_prev->ring_next = host;
+    s->cursor->ring_prev = host;
+}
+
+void ring_remove(Scheduler *s, Host *host) {
+    host->on_ring = 0;
+    if (host->ring_next == host) {
+        s->cursor = NULL;
+        return;
+    }
+    host->ring_prev->ring_next = host->ring_next;
+    host->ring_next->ring_prev = host->ring_prev;
+    if (s->cursor == host) {
+        s->cursor = host->ring_next;
+    }
+}
+
+// Queue a URL behind the others for its host. With block set the caller
+// waits while the scheduler is full; links found mid-crawl never block,
+// since the workers that would drain the queue are the ones pushing.
+void sched_push(Scheduler *s, char *url, int depth, int block) {
+    UrlItem *item = malloc(sizeof(UrlItem));
+    if (!item) {
+        fprintf(stderr, "Memory allocation error\n");
+        exit(1);
+    }
+    item->url = url;
+    item->depth = depth;
+    item->attempts = 0;
+    item->next = NULL;
+    char *key = host_key(url);
+
+    pthread_mutex_lock(&s->lock);
+    while (block && s->pending >= QUEUE_CAPACITY) {
+        pthread_cond_wait(&s->changed, &s->lock);
+    }
+    Host *host = find_host(s, key);
+    item->host = host;
+    item->index = url_total++;
+    if (host->pending_tail) {
+        host->pending_tail->next = item;
+    } else {
+        host->pending = item;
+    }
+    host->pending_tail = item;
+    s->pending++;
+    ring_insert(s, host);
+    pthread_cond_broadcast(&s->changed);
+    pthread_mutex_unlock(&s->lock);
+}
+
+// Time at which host may start another transfer, ignoring its
+// concurrency cap; <= now means it can go right away
+double host_ready_at(Host *host, double now) {
+    if (config.rate > 0) {
+        double burst = config.rate < 1 ? 1 : config.rate;
+        host->tokens += (now - host->refilled_at) * config.rate;
+        if (host->tokens > burst) {
+            host->tokens = burst;
+        }
+        host->refilled_at = now;
+    }
+
+    double ready = host->blocked_until;
+    if (config.rate > 0 && host->tokens < 1) {
+        double token_at = now + (1 - host->tokens) / config.rate;
+        if (token_at > ready) {
+            ready = token_at;
+        }
+    }
+    return ready;
+}
+
+// Take the next URL from the first eligible host on the ring, starting at
+// the cursor. Returns NULL if none can go yet; *wake_at then says when a
+// rate-limited or backing-off host frees up (0 if only a finishing
+// transfer can help). Caller holds the lock.
+UrlItem *sched_take(Scheduler *s, double *wake_at) {
+    double now = now_seconds();
+    *wake_at = 0;
+
+    // Retries whose backoff is over go back to the front of their host
+    while (s->delayed && s->delayed->retry_at <= now) {
+        UrlItem *item = s->delayed;
+        s->delayed = item->next;
+        item->next = item->host->pending;
+        item->host->pending = item;
+        if (item->host->pending_tail == NULL) {
+            item->host->pending_tail = item;
+        }
+        ring_insert(s, item->host);
+    }
+
+    Host *host = s->cursor;
+    for (int seen = 0; host != NULL && (seen == 0 || host != s->cursor); seen = 1) {
+        Host *next = host->ring_next;
+
+        if (config.per_host == 0 || host->active < config.per_host) {
+            double ready = host_ready_at(host, now);
+            if (ready <= now) {
+                UrlItem *item = host->pending;
+                host->pending = item->next;
+                if (host->pending == NULL) {
+                    host->pending_tail = NULL;
+                }
+                item->next = NULL;
+
+                host->active++;
+                if (config.rate > 0) {
+                    host->tokens -= 1;
+                }
+                s->pending--;
+                s->active++;
+
+                // Round-robin: the next pop starts at the following host
+                s->cursor = next;
+                if (host->pending == NULL) {
+                    ring_remove(s, host);
+                }
+                pthread_cond_broadcast(&s->changed);
+                return item;
+            }
+            if (*wake_at == 0 || ready < *wake_at) {
+                *wake_at = ready;
+            }
+        }
+        host = next;
+    }
+    if (s->delayed && (*wake_at == 0 || s->delayed->retry_at < *wake_at)) {
+        *wake_at = s->delayed->retry_at;
+    }
+    return NULL;
+}
+
+// Non-blocking pop for the event loop
+UrlItem *sched_try_pop(Scheduler *s, double *wake_at) {
+    pthread_mutex_lock(&s->lock);
+    UrlItem *item = sched_take(s, wake_at);
+    pthread_mutex_unlock(&s->lock);
+    return item;
+}
+
+// Blocking pop for pool workers. Returns NULL once input is closed and no
+// URL is waiting or in flight; an in-flight one might still be retried.
+UrlItem *sched_pop(Scheduler *s) {
+    pthread_mutex_lock(&s->lock);
+    while (1) {
+        double wake_at;
+        UrlItem *item = sched_take(s, &wake_at);
+        if (item) {
+            pthread_mutex_unlock(&s->lock);
+            return item;
+        }
+        if (s->closed && s->pending == 0 && s->active == 0) {
+            pthread_mutex_unlock(&s->lock);
+            return NULL;
+        }
+
+        if (wake_at > 0) {
+            struct timespec ts;
+            ts.tv_sec = (time_t)wake_at;
+            ts.tv_nsec = (long)((wake_at - ts.tv_sec) * 1e9);
+            pthread_cond_timedwait(&s->changed, &s->lock, &ts);
+        } else {
+            pthread_cond_wait(&s->changed, &s->lock);
+        }
+    }
+}
+
+// A transfer finished for good: free its host slot
+void sched_release(Scheduler *s, UrlItem *item, int success) {
+    pthread_mutex_lock(&s->lock);
+    item->host->active--;
+    if (success) {
+        item->host->backoff = 1.0;
+    }
+    s->active--;
+    pthread_cond_broadcast(&s->changed);
+    pthread_mutex_unlock(&s->lock);
+}
+
+// The host asked us to slow down: put the URL back at the front of its
+// queue and block the host for Retry-After seconds, or an exponential
+// backoff when it didn't say
+double sched_retry(Scheduler *s, UrlItem *item, long retry_after) {
+    pthread_mutex_lock(&s->lock);
+    Host *host = item->host;
+    double delay = retry_after > 0 ? retry_after : host->backoff;
+    if (retry_after <= 0) {
+        host->backoff = host->backoff * 2 > MAX_BACKOFF ? MAX_BACKOFF : host->backoff * 2;
+    }
+    double until = now_seconds() + delay;
+    if (until > host->blocked_until) {
+        host->blocked_until = until;
+    }
+
+    item->next = host->pending;
+    host->pending = item;
+    if (host->pending_tail == NULL) {
+        host->pending_tail = item;
+    }
+    host->active--;
+    s->active--;
+    s->pending++;
+    ring_insert(s, host);
+    pthread_cond_broadcast(&s->changed);
+    pthread_mutex_unlock(&s->lock);
+    return delay;
+}
+
+// The transfer failed in a way that may pass: hold the URL back for an
+// exponential backoff with jitter, without blocking the rest of its host
+double sched_defer(Scheduler *s, UrlItem *item) {
+    // Any shift past a few already exceeds MAX_BACKOFF; capping it keeps
+    // a large -a from overflowing the int
+    int shift = item->attempts - 1;
+    if (shift > 16) {
+        shift = 16;
+    } else if (shift < 0) {
+        shift = 0;
+    }
+    double delay = RETRY_BASE * (1 << shift);
+    if (delay > MAX_BACKOFF) {
+        delay = MAX_BACKOFF;
+    }
+    unsigned int seed = (unsigned int)(now_seconds() * 1e6) ^ (unsigned int)item->index;
+    delay *= 0.5 + 0.5 * rand_r(&seed) / RAND_MAX;
+
+    pthread_mutex_lock(&s->lock);
+    item->retry_at = now_seconds() + delay;
+    UrlItem **link = &s->delayed;
+    while (*link && (*link)->retry_at <= item->retry_at) {
+        link = &(*link)->next;
+    }
+    item->next = *link;
+    *link = item;
+    item->host->active--;
+    s->active--;
+    s->pending++;
+    pthread_cond_broadcast(&s->changed);
+    pthread_mutex_unlock(&s->lock);
+    return delay;
+}
+
+void sched_close(Scheduler *s) {
+    pthread_mutex_lock(&s->lock);
+    s->closed = 1;
+    pthread_cond_broadcast(&s->changed);
+    pthread_mutex_unlock(&s->lock);
+}
+
+void sched_free(Scheduler *s) {
+    for (int i = 0; i < HOST_BUCKETS; i++) {
+        Host *host = s->buckets[i];
+        while (host != NULL) {
+            Host *next = host->next;
+            free(host->key);
+            if (host->ttfb) {
+                free(host->ttfb->counts);
+                free(host->ttfb);
+            }
+            free(host);
+            host = next;
+        }
+        s->buckets[i] = NULL;
+    }
+}
+
+void append_summary(char *summary, size_t cap, const char *fmt, ...) {
+    size_t len = strlen(summary);
+    if (len + 2 >= cap) {
+        return;
+    }
+    if (len > 0) {
+        strcpy(summary + len, ", ");
+        len += 2;
+    }
+    va_list ap;
+    va_start(ap, fmt);
+    vsnprintf(summary + len, cap - len, fmt, ap);
+    va_end(ap);
+}
+
+// raw: the body as-is in output_N.txt
+typedef struct {
+    FILE *fp;
+    char filename[64];
+} RawState;
+
+void *raw_open(UrlItem *item) {
+    RawState *st = malloc(sizeof(RawState));
+    if (!st) {
+        return NULL;
+    }
+    snprintf(st->filename, sizeof(st->filename), "output_%ld.txt", item->index);
+    st->fp = fopen(st->filename, "w");
+    if (!st->fp) {
+        fprintf(stderr, "Error opening file %s\n", st->filename);
+        free(st);
+        return NULL;
+    }
+    return st;
+}
+
+int raw_write(void *state, const char *data, size_t len) {
+    RawState *st = (RawState *)state;
+    return fwrite(data, 1, len, st->fp) == len ? 0 : -1;
+}
+
+void raw_close(void *state, char *summary, size_t cap, StoreRecord *stored) {
+    RawState *st = (RawState *)state;
+    fclose(st->fp);
+    append_summary(summary, cap, "%s", st->filename);
+    free(st);
+}
+
+void raw_abort(void *state) {
+    RawState *st = (RawState *)state;
+    fclose(st->fp);
+    unlink(st->filename);
+    free(st);
+}
+
+// gzip: the body deflated into output_N.txt.gz as it arrives
+typedef struct {
+    FILE *fp;
+    z_stream zs;
+    char filename[64];
+    unsigned char out[16384];
+} GzipState;
+
+void *gzip_open(UrlItem *item) {
+    GzipState *st = malloc(sizeof(GzipState));
+    if (!st) {
+        return NULL;
+    }
+    memset(&st->zs, 0, sizeof(st->zs));
+    // windowBits 15 + 16 writes a gzip header instead of a zlib one
+    if (deflateInit2(&st->zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+        free(st);
+        return NULL;
+    }
+    snprintf(st->filename, sizeof(st->filename), "output_%ld.txt.gz", item->index);
+    st->fp = fopen(st->filename, "wb");
+    if (!st->fp) {
+        fprintf(stderr, "Error opening file %s\n", st->filename);
+        deflateEnd(&st->zs);
+        free(st);
+        return NULL;
+    }
+    return st;
+}
+
+int gzip_deflate(GzipState *st, int flush) {
+    int ret;
+    do {
+        st->zs.next_out = st->out;
+        st->zs.avail_out = sizeof(st->out);
+        ret = deflate(&st->zs, flush);
+        if (ret == Z_STREAM_ERROR) {
+            return -1;
+        }
+        size_t have = sizeof(st->out) - st->zs.avail_out;
+        if (have > 0 && fwrite(st->out, 1, have, st->fp) != have) {
+            return -1;
+        }
+    } while (st->zs.avail_out == 0);
+    return 0;
+}
+
+int gzip_write(void *state, const char *data, size_t len) {
+    GzipState *st = (GzipState *)state;
+    st->zs.next_in = (unsigned char *)data;
+    st->zs.avail_in = len;
+    return gzip_deflate(st, Z_NO_FLUSH);
+}
+
+void gzip_close(void *state, char *summary, size_t cap, StoreRecord *stored) {
+    GzipState *st = (GzipState *)state;
+    st->zs.next_in = NULL;
+    st->zs.avail_in = 0;
+    gzip_deflate(st, Z_FINISH);
+    append_summary(summary, cap, "%s (%lu -> %lu bytes)", st->filename,
+                   st->zs.total_in, st->zs.total_out);
+    deflateEnd(&st->zs);
+    fclose(st->fp);
+    free(st);
+}
+
+void gzip_abort(void *state) {
+    GzipState *st = (GzipState *)state;
+    deflateEnd(&st->zs);
+    fclose(st->fp);
+    unlink(st->filename);
+    free(st);
+}
+
+// hash: 64-bit FNV-1a of the body, for spotting duplicate content
+void *hash_open(UrlItem *item) {
+    (void)item;
+    unsigned long long *hash = malloc(sizeof(unsigned long long));
+    if (hash) {
+        *hash = 14695981039346656037ULL;
+    }
+    return hash;
+}
+
+int hash_write(void *state, const char *data, size_t len) {
+    unsigned long long hash = *(unsigned long long *)state;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)data[i];
+        hash *= 1099511628211ULL;
+    }
+    *(unsigned long long *)state = hash;
+    return 0;
+}
+
+void hash_close(void *state, char *summary, size_t cap, StoreRecord *stored) {
+    append_summary(summary, cap, "fnv1a %016llx", *(unsigned long long *)state);
+    free(state);
+}
+
+void hash_abort(void *state) {
+    free(state);
+}
+
+void scanner_init(LinkScanner *sc) {
+    sc->phase = LINK_SCAN;
+    sc->matched = 0;
+}
+
+// Feed a chunk to the scanner, calling emit for every complete href value
+void scan_links(LinkScanner *sc, const char *data, size_t len,
+                void (*emit)(void *ctx, char *link), void *ctx) {
+    static const char pattern[] = "href";
+
+    for (size_t i = 0; i < len; i++) {
+        char c = data[i];
+        switch (sc->phase) {
+            case LINK_SCAN:
+                if (tolower((unsigned char)c) == pattern[sc->matched]) {
+                    if (++sc->matched == 4) {
+                        sc->phase = LINK_NAME;
+                    }
+                } else {
+                    sc->matched = tolower((unsigned char)c) == 'h';
+                }
+                break;
+            case LINK_NAME:
+                if (c == '=') {
+                    sc->phase = LINK_EQUALS;
+                } else if (!isspace((unsigned char)c)) {
+                    scanner_init(sc);
+                }
+                break;
+            case LINK_EQUALS:
+                if (isspace((unsigned char)c)) {
+                    break;
+                }
+                if (c == '>') {
+                    scanner_init(sc);
+                    break;
+                }
+                sc->phase = LINK_VALUE;
+                sc->len = 0;
+                sc->overflow = 0;
+                if (c == '"' || c == '\'') {
+                    sc->quote = c;
+                } else {
+                    sc->quote = 0;
+                    sc->value[sc->len++] = c;
+                }
+                break;
+            case LINK_VALUE:
+                if (sc->quote ? c == sc->quote : (isspace((unsigned char)c) || c == '>')) {
+                    if (sc->len > 0 && !sc->overflow) {
+                        sc->value[sc->len] = '\0';
+                        emit(ctx, sc->value);
+                    }
+                    scanner_init(sc);
+                } else if (sc->len < MAX_LINK_LENGTH - 1) {
+                    sc->value[sc->len++] = c;
+                } else {
+                    sc->overflow = 1;
+                }
+                break;
+        }
+    }
+}
+
+// links: href values pulled out of the HTML into output_N.links.txt
+typedef struct {
+    FILE *fp;
+    char filename[64];
+    LinkScanner scanner;
+    long count;
+} LinkState;
+
+void *links_open(UrlItem *item) {
+    LinkState *st = malloc(sizeof(LinkState));
+    if (!st) {
+        return NULL;
+    }
+    snprintf(st->filename, sizeof(st->filename), "output_%ld.links.txt", item->index);
+    st->fp = fopen(st->filename, "w");
+    if (!st->fp) {
+        fprintf(stderr, "Error opening file %s\n", st->filename);
+        free(st);
+        return NULL;
+    }
+    scanner_init(&st->scanner);
+    st->count = 0;
+    return st;
+}
+
+void write_link(void *ctx, char *link) {
+    LinkState *st = (LinkState *)ctx;
+    fprintf(st->fp, "%s\n", link);
+    st->count++;
+}
+
+int links_write(void *state, const char *data, size_t len) {
+    LinkState *st = (LinkState *)state;
+    scan_links(&st->scanner, data, len, write_link, st);
+    return 0;
+}
+
+void links_close(void *state, char *summary, size_t cap, StoreRecord *stored) {
+    LinkState *st = (LinkState *)state;
+    fclose(st->fp);
+    append_summary(summary, cap, "%ld links -> %s", st->count, st->filename);
+    free(st);
+}
+
+void links_abort(void *state) {
+    LinkState *st = (LinkState *)state;
+    fclose(st->fp);
+    unlink(st->filename);
+    free(st);
+}
+
+int write_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(fd, data, len);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        data += n;
+        len -= n;
+    }
+    return 0;
+}
+
+void writer_flush(StoreWriter *w) {
+    if (w->buf_len > 0 && write_all(w->fd, w->buf, w->buf_len) == -1) {
+        perror("store: write");
+    }
+    w->buf_len = 0;
+}
+
+// Finish the current segment: flush, and give back the unused part of
+// the preallocated space
+void writer_close_segment(StoreWriter *w) {
+    writer_flush(w);
+    if (ftruncate(w->fd, w->offset) == -1) {
+        perror("store: ftruncate");
+    }
+    close(w->fd);
+    fclose(w->index);
+}
+
+int writer_open_segment(StoreWriter *w) {
+    pthread_mutex_lock(&store_lock);
+    w->segment = store_segments++;
+    pthread_mutex_unlock(&store_lock);
+
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/segment-%05d.warc", config.store_dir, w->segment);
+    w->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (w->fd == -1) {
+        fprintf(stderr, "store: %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    // Reserve the whole segment up front so it is laid out contiguously;
+    // filesystems without fallocate just grow it as we go
+    if (fallocate(w->fd, 0, 0, SEGMENT_SIZE) == -1 && errno != EOPNOTSUPP) {
+        perror("store: fallocate");
+    }
+
+    snprintf(path, sizeof(path), "%s/segment-%05d.idx", config.store_dir, w->segment);
+    w->index = fopen(path, "w");
+    if (!w->index) {
+        fprintf(stderr, "store: %s: %s\n", path, strerror(errno));
+        close(w->fd);
+        return -1;
+    }
+    w->offset = 0;
+    w->buf_len = 0;
+    return 0;
+}
+
+StoreWriter *get_writer() {
+    if (thread_writer) {
+        return thread_writer;
+    }
+    StoreWriter *w = malloc(sizeof(StoreWriter));
+    if (w) {
+        w->buf = malloc(STORE_BUFFER);
+    }
+    if (!w || !w->buf) {
+        fprintf(stderr, "Memory allocation error\n");
+        exit(1);
+    }
+    if (writer_open_segment(w) == -1) {
+        free(w->buf);
+        free(w);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&store_lock);
+    w->next = store_writers;
+    store_writers = w;
+    pthread_mutex_unlock(&store_lock);
+    thread_writer = w;
+    return w;
+}
+
+// Large pieces bypass the buffer so they are written once, sequentially
+void writer_append(StoreWriter *w, const char *data, size_t len) {
+    if (w->buf_len + len > STORE_BUFFER) {
+        writer_flush(w);
+    }
+    if (len >= STORE_BUFFER) {
+        if (write_all(w->fd, data, len) == -1) {
+            perror("store: write");
+        }
+    } else {
+        memcpy(w->buf + w->buf_len, data, len);
+        w->buf_len += len;
+    }
+    w->offset += len;
+}
+
+// Number new segments after any a previous run left in dir, so its records
+// (and the cache entries pointing at them) stay valid
+int next_segment(const char *dir) {
+    int next = 0;
+    DIR *d = opendir(dir);
+    if (!d) {
+        return 0;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        int segment;
+        if (sscanf(entry->d_name, "segment-%d.", &segment) == 1 && segment >= next) {
+            next = segment + 1;
+        }
+    }
+    closedir(d);
+    return next;
+}
+
+// Called once the engines are done; every thread has stopped writing
+void close_store() {
+    StoreWriter *w = store_writers;
+    while (w != NULL) {
+        StoreWriter *next = w->next;
+        writer_close_segment(w);
+        free(w->buf);
+        free(w);
+        w = next;
+    }
+    store_writers = NULL;
+}
+
+// store: the body appended as a WARC-style record to this thread's
+// segment. The record is collected (and compressed) per transfer, since
+// the event loop interleaves many transfers on one thread.
+typedef struct {
+    char *url;
+    char *body;
+    size_t len;
+    size_t cap;
+    size_t raw_len;
+    int gzip;
+    z_stream zs;
+} StoreState;
+
+int store_reserve(StoreState *st, size_t extra) {
+    if (st->len + extra <= st->cap) {
+        return 0;
+    }
+    size_t cap = st->cap ? st->cap : 16384;
+    while (cap < st->len + extra) {
+        cap *= 2;
+    }
+    char *body = realloc(st->body, cap);
+    if (!body) {
+        return -1;
+    }
+    st->body = body;
+    st->cap = cap;
+    return 0;
+}
+
+void *store_open(UrlItem *item) {
+    StoreState *st = calloc(1, sizeof(StoreState));
+    if (!st) {
+        return NULL;
+    }
+    st->url = strdup(item->url);
+    st->gzip = config.store_gzip;
+    if (st->gzip && deflateInit2(&st->zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+                                 Z_DEFAULT_STRATEGY) != Z_OK) {
+        free(st->url);
+        free(st);
+        return NULL;
+    }
+    return st;
+}
+
+int store_deflate(StoreState *st, int flush) {
+    do {
+        if (store_reserve(st, 16384) == -1) {
+            return -1;
+        }
+        st->zs.next_out = (unsigned char *)st->body + st->len;
+        st->zs.avail_out = st->cap - st->len;
+        if (deflate(&st->zs, flush) == Z_STREAM_ERROR) {
+            return -1;
+        }
+        st->len = st->cap - st->zs.avail_out;
+    } while (st->zs.avail_out == 0);
+    return 0;
+}
+
+int store_write(void *state, const char *data, size_t len) {
+    StoreState *st = (StoreState *)state;
+    st->raw_len += len;
+    if (st->gzip) {
+        st->zs.next_in = (unsigned char *)data;
+        st->zs.avail_in = len;
+        return store_deflate(st, Z_NO_FLUSH);
+    }
+    if (store_reserve(st, len) == -1) {
+        return -1;
+    }
+    memcpy(st->body + st->len, data, len);
+    st->len += len;
+    return 0;
+}
+
+void store_close(void *state, char *summary, size_t cap, StoreRecord *stored) {
+    StoreState *st = (StoreState *)state;
+    if (st->gzip) {
+        st->zs.next_in = NULL;
+        st->zs.avail_in = 0;
+        store_deflate(st, Z_FINISH);
+        deflateEnd(&st->zs);
+    }
+
+    char header[4096 + 256];
+    int header_len = snprintf(header, sizeof(header),
+                              "WARC/1.0\r\nWARC-Type: response\r\nWARC-Target-URI: %.4096s\r\n"
+                              "%sContent-Length: %zu\r\n\r\n",
+                              st->url, st->gzip ? "Content-Encoding: gzip\r\n" : "", st->len);
+    size_t record_len = header_len + st->len + 4;
+
+    StoreWriter *w = get_writer();
+    if (w) {
+        // Start a new segment rather than split a record across two
+        if (w->offset > 0 && w->offset + (off_t)record_len > SEGMENT_SIZE) {
+            writer_close_segment(w);
+            if (writer_open_segment(w) == -1) {
+                exit(1);
+            }
+        }
+        writer_append(w, header, header_len);
+        off_t body_offset = w->offset;
+        writer_append(w, st->body ? st->body : "", st->len);
+        writer_append(w, "\r\n\r\n", 4);
+
+        // Lookups go straight to the body: offset, stored length, raw length
+        fprintf(w->index, "%lld\t%zu\t%zu\t%s\t%s\n", (long long)body_offset, st->len,
+                st->raw_len, st->gzip ? "gzip" : "raw", st->url);
+        append_summary(summary, cap, "segment-%05d.warc @ %lld", w->segment,
+                       (long long)body_offset);
+        stored->segment = w->segment;
+        stored->offset = body_offset;
+        stored->len = st->len;
+        stored->gzip = st->gzip;
+    }
+
+    free(st->body);
+    free(st->url);
+    free(st);
+}
+
+// Nothing reaches the segment until close, so dropping the buffer is enough
+void store_abort(void *state) {
+    StoreState *st = (StoreState *)state;
+    if (st->gzip) {
+        deflateEnd(&st->zs);
+    }
+    free(st->body);
+    free(st->url);
+    free(st);
+}
+
+const Processor processors[] = {
+    { "raw", raw_open, raw_write, raw_close, raw_abort, 0 },
+    { "gzip", gzip_open, gzip_write, gzip_close, gzip_abort, 0 },
+    { "hash", hash_open, hash_write, hash_close, hash_abort, 0 },
+    { "links", links_open, links_write, links_close, links_abort, 0 },
+    { "store", store_open, store_write, store_close, store_abort, 0 }
+};
+
+// Feed one record's body to write straight from the mapped segment,
+// inflating it first if it was stored compressed
+int replay_record(const char *dir, const char *url, const StoreRecord *rec,
+                  int (*write)(void *state, const char *data, size_t len), void *state) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/segment-%05d.warc", dir, rec->segment);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat sb;
+    if (fd == -1 || fstat(fd, &sb) == -1) {
+        fprintf(stderr, "Failed to open segment %s\n", path);
+        if (fd != -1) {
+            close(fd);
+        }
+        return 1;
+    }
+    if (rec->offset + (long long)rec->len > sb.st_size) {
+        fprintf(stderr, "Record for %s is past the end of its segment\n", url);
+        close(fd);
+        return 1;
+    }
+
+    char *map = NULL;
+    if (sb.st_size > 0) {
+        map = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED) {
+            perror("mmap");
+            close(fd);
+            return 1;
+        }
+    }
+    close(fd);
+
+    if (rec->gzip) {
+        z_stream zs;
+        unsigned char out[65536];
+        memset(&zs, 0, sizeof(zs));
+        inflateInit2(&zs, 15 + 16);
+        zs.next_in = (unsigned char *)map + rec->offset;
+        zs.avail_in = rec->len;
+        int ret;
+        do {
+            zs.next_out = out;
+            zs.avail_out = sizeof(out);
+            ret = inflate(&zs, Z_NO_FLUSH);
+            if (write(state, (char *)out, sizeof(out) - zs.avail_out) == -1) {
+                break;
+            }
+        } while (ret == Z_OK);
+        inflateEnd(&zs);
+    } else if (rec->len > 0) {
+        write(state, map + rec->offset, rec->len);
+    }
+    if (map) {
+        munmap(map, sb.st_size);
+    }
+    return 0;
+}
+
+int stdout_write(void *state, const char *data, size_t len) {
+    (void)state;
+    return write_all(STDOUT_FILENO, data, len);
+}
+
+// scraper -R dir [url...]: look records up in a store without copying.
+// Segments are mmapped and raw bodies written straight from the mapping;
+// with no URLs the index is listed. A URL stored more than once is read
+// from its newest record: the highest segment, then the latest line.
+int run_reader(char *dir, char **urls, int num_urls) {
+    DIR *d = opendir(dir);
+    if (!d) {
+        fprintf(stderr, "Failed to open store %s: %s\n", dir, strerror(errno));
+        return 1;
+    }
+
+    int status = 0;
+    StoreRecord *found = malloc((num_urls + 1) * sizeof(StoreRecord));
+    for (int i = 0; i < num_urls; i++) {
+        found[i].segment = -1;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(d)) != NULL) {
+        int segment;
+        char suffix[8];
+        if (sscanf(entry->d_name, "segment-%d.%7s", &segment, suffix) != 2 ||
+            strcmp(suffix, "idx") != 0) {
+            continue;
+        }
+
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/segment-%05d.idx", dir, segment);
+        FILE *index = fopen(path, "r");
+        if (!index) {
+            fprintf(stderr, "Failed to open segment %s\n", path);
+            status = 1;
+            continue;
+        }
+
+        char *line = NULL;
+        size_t line_cap = 0;
+        while (getline(&line, &line_cap, index) != -1) {
+            long long offset;
+            size_t len, raw_len;
+            char encoding[8];
+            int url_at;
+            line[strcspn(line, "\n")] = 0;
+            if (sscanf(line, "%lld\t%zu\t%zu\t%7s\t%n", &offset, &len, &raw_len,
+                       encoding, &url_at) != 4) {
+                continue;
+            }
+            char *url = line + url_at;
+
+            if (num_urls == 0) {
+                printf("%s\t%zu\t%s\tsegment-%05d.warc@%lld\n", url, raw_len, encoding,
+                       segment, offset);
+                continue;
+            }
+            for (int i = 0; i < num_urls; i++) {
+                if (found[i].segment > segment || strcmp(urls[i], url) != 0) {
+                    continue;
+                }
+                found[i].segment = segment;
+                found[i].offset = offset;
+                found[i].len = len;
+                found[i].gzip = strcmp(encoding, "gzip") == 0;
+            }
+        }
+        free(line);
+        fclose(index);
+    }
+    closedir(d);
+
+    fflush(stdout);
+    for (int i = 0; i < num_urls; i++) {
+        if (found[i].segment == -1) {
+            fprintf(stderr, "Not in store: %s\n", urls[i]);
+            status = 1;
+        } else if (replay_record(dir, urls[i], &found[i], stdout_write, NULL) != 0) {
+            status = 1;
+        }
+    }
+    free(found);
+    return status;
+}
+
+// 64-bit FNV-1a with a final mix, so the top bits pick shards evenly
+unsigned long long url_hash(const char *url) {
+    unsigned long long hash = 14695981039346656037ULL;
+    for (const char *c = url; *c; c++) {
+        hash ^= (unsigned char)*c;
+        hash *= 1099511628211ULL;
+    }
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    return hash ? hash : 1;
+}
+
+void init_seen() {
+    if (config.bloom_mb > 0) {
+        bloom_nbits = (size_t)config.bloom_mb * 1024 * 1024 * 8;
+        bloom_bits = calloc(bloom_nbits / 64, sizeof(unsigned long long));
+        if (!bloom_bits) {
+            fprintf(stderr, "Memory allocation error\n");
+            exit(1);
+        }
+        return;
+    }
+    for (int i = 0; i < SEEN_SHARDS; i++) {
+        pthread_mutex_init(&seen_shards[i].lock, NULL);
+        seen_shards[i].cap = 1024;
+        seen_shards[i].count = 0;
+        seen_shards[i].slots = calloc(seen_shards[i].cap, sizeof(unsigned long long));
+        if (!seen_shards[i].slots) {
+            fprintf(stderr, "Memory allocation error\n");
+            exit(1);
+        }
+    }
+}
+
+void free_seen() {
+    if (bloom_bits) {
+        free(bloom_bits);
+        return;
+    }
+    for (int i = 0; i < SEEN_SHARDS; i++) {
+        free(seen_shards[i].slots);
+    }
+}
+
+// Insert into a shard's table, which the caller has locked
+int shard_insert(SeenShard *shard, unsigned long long hash) {
+    size_t mask = shard->cap - 1;
+    for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+        if (shard->slots[i] == hash) {
+            return 0;
+        }
+        if (shard->slots[i] == 0) {
+            shard->slots[i] = hash;
+            shard->count++;
+            return 1;
+        }
+    }
+}
+
+// Returns 1 the first time a URL is seen. Bloom mode sets its bits with
+// atomic ORs and may rarely call a new URL seen; exact mode never does.
+int seen_add(const char *url) {
+    unsigned long long hash = url_hash(url);
+
+    if (bloom_bits) {
+        unsigned long long h2 = (hash >> 32) | 1;
+        int added = 0;
+        for (int i = 0; i < BLOOM_HASHES; i++) {
+            size_t bit = (hash + i * h2) % bloom_nbits;
+            unsigned long long mask = 1ULL << (bit % 64);
+            unsigned long long old = __atomic_fetch_or(&bloom_bits[bit / 64], mask,
+                                                       __ATOMIC_RELAXED);
+            if (!(old & mask)) {
+                added = 1;
+            }
+        }
+        return added;
+    }
+
+    SeenShard *shard = &seen_shards[hash >> 56];
+    pthread_mutex_lock(&shard->lock);
+
+    // Grow at 70% load
+    if (shard->count * 10 >= shard->cap * 7) {
+        unsigned long long *old = shard->slots;
+        size_t old_cap = shard->cap;
+        shard->cap *= 2;
+        shard->slots = calloc(shard->cap, sizeof(unsigned long long));
+        if (!shard->slots) {
+            fprintf(stderr, "Memory allocation error\n");
+            exit(1);
+        }
+        shard->count = 0;
+        for (size_t i = 0; i < old_cap; i++) {
+            if (old[i]) {
+                shard_insert(shard, old[i]);
+            }
+        }
+        free(old);
+    }
+
+    int added = shard_insert(shard, hash);
+    pthread_mutex_unlock(&shard->lock);
+    return added;
+}
+
+// Resolve link against base and put it in canonical form: http(s) only,
+// lower-case host, no default port, no fragment. NULL if it doesn't qualify.
+char *normalize_url(CURLU *base, const char *link) {
+    CURLU *h = curl_url_dup(base);
+    char *scheme = NULL, *host = NULL, *url = NULL, *result = NULL;
+
+    if (h && curl_url_set(h, CURLUPART_URL, link, 0) == CURLUE_OK &&
+        curl_url_get(h, CURLUPART_SCHEME, &scheme, 0) == CURLUE_OK &&
+        (strcmp(scheme, "http") == 0 || strcmp(scheme, "https") == 0) &&
+        curl_url_get(h, CURLUPART_HOST, &host, 0) == CURLUE_OK) {
+        for (char *c = host; *c; c++) {
+            *c = tolower((unsigned char)*c);
+        }
+        curl_url_set(h, CURLUPART_HOST, host, 0);
+        curl_url_set(h, CURLUPART_FRAGMENT, NULL, 0);
+        if (curl_url_get(h, CURLUPART_URL, &url, CURLU_NO_DEFAULT_PORT) == CURLUE_OK) {
+            result = strdup(url);
+        }
+    }
+    curl_free(scheme);
+    curl_free(host);
+    curl_free(url);
+    curl_url_cleanup(h);
+    return result;
+}
+
+// Whether a crawl may follow a link to host from a page on page_host
+int host_allowed(const char *host, const char *page_host) {
+    if (config.domain_limit == DOMAIN_ANY) {
+        return 1;
+    }
+    if (config.domain_limit == DOMAIN_SAME_HOST) {
+        return strcmp(host, page_host) == 0;
+    }
+    size_t len = strlen(host), suffix = strlen(config.domain);
+    return len >= suffix && strcmp(host + len - suffix, config.domain) == 0 &&
+           (len == suffix || host[len - suffix - 1] == '.');
+}
+
+// Queue a URL unless it was seen before or the page budget is spent.
+// Takes ownership of url.
+int enqueue_url(char *url, int depth, int block) {
+    if (config.max_pages > 0 &&
+        __atomic_load_n(&url_total, __ATOMIC_RELAXED) >= config.max_pages) {
+        free(url);
+        return 0;
+    }
+    if (config.max_depth > 0 && !seen_add(url)) {
+        free(url);
+        return 0;
+    }
+    sched_push(&sched, url, depth, block);
+    return 1;
+}
+
+// Seed URLs from the list; in crawl mode they are normalized and deduped
+void enqueue_seed(char *url) {
+    if (config.max_depth > 0) {
+        CURLU *base = curl_url();
+        char *normalized = normalize_url(base, url);
+        curl_url_cleanup(base);
+        if (normalized) {
+            free(url);
+            url = normalized;
+        }
+    }
+    enqueue_url(url, 0, 1);
+}
+
+// crawl: added automatically with -d; feeds followed links to the frontier.
+// Links are held until the page is complete, so an attempt that is
+// retried or turns out to be an error page queues nothing.
 typedef struct {
-    char url[1024];
-    int index;
-} ThreadData;
+    LinkScanner scanner;
+    CURLU *base;
+    char *host;
+    int depth;
+    long found;
+    char **links;           // Normalized and allowed, not yet queued
+    long num_links;
+    long links_cap;
+} CrawlState;
+
+void *crawl_open(UrlItem *item) {
+    CrawlState *st = malloc(sizeof(CrawlState));
+    if (!st) {
+        return NULL;
+    }
+    scanner_init(&st->scanner);
+    st->base = curl_url();
+    st->host = NULL;
+    if (!st->base || curl_url_set(st->base, CURLUPART_URL, item->url, 0) != CURLUE_OK ||
+        curl_url_get(st->base, CURLUPART_HOST, &st->host, 0) != CURLUE_OK) {
+        curl_url_cleanup(st->base);
+        st->base = NULL;
+    }
+    st->depth = item->depth;
+    st->found = 0;
+    st->links = NULL;
+    st->num_links = 0;
+    st->links_cap = 0;
+    return st;
+}
+
+void follow_link(void *ctx, char *link) {
+    CrawlState *st = (CrawlState *)ctx;
+    st->found++;
+    if (st->base == NULL || st->depth >= config.max_depth) {
+        return;
+    }
+
+    char *url = normalize_url(st->base, link);
+    if (!url) {
+        return;
+    }
+
+    CURLU *h = curl_url();
+    char *host = NULL;
+    int allowed = h && curl_url_set(h, CURLUPART_URL, url, 0) == CURLUE_OK &&
+                  curl_url_get(h, CURLUPART_HOST, &host, 0) == CURLUE_OK &&
+                  host_allowed(host, st->host);
+    curl_free(host);
+    curl_url_cleanup(h);
+
+    if (allowed && st->num_links == st->links_cap) {
+        long links_cap = st->links_cap ? st->links_cap * 2 : 64;
+        char **links = realloc(st->links, links_cap * sizeof(char *));
+        if (links) {
+            st->links = links;
+            st->links_cap = links_cap;
+        }
+    }
+    if (allowed && st->num_links < st->links_cap) {
+        st->links[st->num_links++] = url;
+    } else {
+        free(url);
+    }
+}
+
+int crawl_write(void *state, const char *data, size_t len) {
+    CrawlState *st = (CrawlState *)state;
+    scan_links(&st->scanner, data, len, follow_link, st);
+    return 0;
+}
+
+void crawl_abort(void *state) {
+    CrawlState *st = (CrawlState *)state;
+    for (long i = 0; i < st->num_links; i++) {
+        free(st->links[i]);
+    }
+    free(st->links);
+    curl_free(st->host);
+    curl_url_cleanup(st->base);
+    free(st);
+}
+
+void crawl_close(void *state, char *summary, size_t cap, StoreRecord *stored) {
+    CrawlState *st = (CrawlState *)state;
+    long queued = 0;
+    for (long i = 0; i < st->num_links; i++) {
+        queued += enqueue_url(st->links[i], st->depth + 1, 0);
+    }
+    st->num_links = 0;
+    append_summary(summary, cap, "depth %d, %ld new of %ld links", st->depth,
+                   queued, st->found);
+    crawl_abort(st);
+}
+
+const Processor crawl_processor = { "crawl", crawl_open, crawl_write, crawl_close, crawl_abort, 1 };
+
+// An unchanged page still has links to follow: on a 304 while crawling,
+// scan the copy the store kept on an earlier run
+void crawl_stored(UrlItem *item, const StoreRecord *stored, char *summary, size_t cap) {
+    void *state = crawl_open(item);
+    if (!state) {
+        return;
+    }
+    if (replay_record(config.store_dir, item->url, stored, crawl_write, state) == 0) {
+        crawl_close(state, summary, cap, NULL);
+    } else {
+        crawl_abort(state);
+    }
+}
+
+// Comma-separated stage names from -p; an empty list discards bodies
+int parse_stages(char *list, Config *config) {
+    config->num_stages = 0;
+    char *copy = strdup(list);
+    char *save;
+    if (!copy) {
+        fprintf(stderr, "Memory allocation error\n");
+        exit(1);
+    }
+
+    for (char *name = strtok_r(copy, ",", &save); name; name = strtok_r(NULL, ",", &save)) {
+        const Processor *found = NULL;
+        for (size_t i = 0; i < sizeof(processors) / sizeof(processors[0]); i++) {
+            if (strcmp(processors[i].name, name) == 0) {
+                found = &processors[i];
+            }
+        }
+        if (!found || config->num_stages == MAX_STAGES) {
+            fprintf(stderr, "Unknown processor '%s' (raw, gzip, hash, links, store)\n", name);
+            free(copy);
+            return -1;
+        }
+        config->stages[config->num_stages++] = found;
+    }
+    free(copy);
+    return 0;
+}
+
+// Copy a field for the cache file, where tabs and newlines separate
+char *cache_field(const char *value) {
+    char *copy = strdup(value);
+    if (!copy) {
+        fprintf(stderr, "Memory allocation error\n");
+        exit(1);
+    }
+    for (char *c = copy; *c; c++) {
+        if (*c == '\t' || *c == '\r' || *c == '\n') {
+            *c = ' ';
+        }
+    }
+    return copy;
+}
+
+// Must hold cache_lock
+CacheEntry *cache_find(const char *url) {
+    CacheEntry *entry = cache_buckets[url_hash(url) % CACHE_BUCKETS];
+    while (entry && strcmp(entry->url, url) != 0) {
+        entry = entry->next;
+    }
+    return entry;
+}
+
+// Replace or add the entry for url. Must hold cache_lock.
+void cache_put(const char *url, const char *etag, const char *last_modified,
+               unsigned long long hash, const StoreRecord *stored) {
+    CacheEntry *entry = cache_find(url);
+    if (entry) {
+        free(entry->etag);
+        free(entry->last_modified);
+    } else {
+        entry = malloc(sizeof(CacheEntry));
+        if (!entry) {
+            fprintf(stderr, "Memory allocation error\n");
+            exit(1);
+        }
+        entry->url = cache_field(url);
+        unsigned long long bucket = url_hash(url) % CACHE_BUCKETS;
+        entry->next = cache_buckets[bucket];
+        cache_buckets[bucket] = entry;
+    }
+    entry->etag = cache_field(etag);
+    entry->last_modified = cache_field(last_modified);
+    entry->hash = hash;
+    entry->stored = *stored;
+}
+
+// Split the next tab-separated field off *line
+char *next_field(char **line) {
+    char *field = *line;
+    char *tab = strchr(field, '\t');
+    if (tab) {
+        *tab = '\0';
+        *line = tab + 1;
+    } else {
+        field[strcspn(field, "\r\n")] = '\0';
+        *line = field + strlen(field);
+    }
+    return field;
+}
+
+// One line per URL: url, ETag, Last-Modified, body hash, then the store
+// record (segment file, offset, length, encoding), left empty when the
+// body was not stored. Records refer to the -S directory. A missing file
+// is an empty cache.
+int cache_load(const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        if (errno == ENOENT) {
+            return 0;
+        }
+        fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    char *line = NULL;
+    size_t cap = 0;
+    long loaded = 0;
+    while (getline(&line, &cap, fp) != -1) {
+        char *rest = line;
+        char *url = next_field(&rest);
+        char *etag = next_field(&rest);
+        char *last_modified = next_field(&rest);
+        char *hash = next_field(&rest);
+        char *segment = next_field(&rest);
+        char *offset = next_field(&rest);
+        char *len = next_field(&rest);
+        char *encoding = next_field(&rest);
+        if (url[0] == '\0') {
+            continue;
+        }
+        StoreRecord stored;
+        if (sscanf(segment, "segment-%d.warc", &stored.segment) != 1) {
+            stored.segment = -1;
+        }
+        stored.offset = strtoll(offset, NULL, 10);
+        stored.len = strtoull(len, NULL, 10);
+        stored.gzip = strcmp(encoding, "gzip") == 0;
+        cache_put(url, etag, last_modified, strtoull(hash, NULL, 16), &stored);
+        loaded++;
+    }
+    free(line);
+    fclose(fp);
+    fprintf(stderr, "Loaded %ld cache entries from %s\n", loaded, path);
+    return 0;
+}
+
+// Write the cache beside the old one and rename it into place, so a
+// crash never leaves a half-written file. Frees every entry.
+void cache_save(const char *path) {
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *fp = fopen(tmp, "w");
+    if (!fp) {
+        fprintf(stderr, "Failed to write %s: %s\n", tmp, strerror(errno));
+    }
+    for (int i = 0; i < CACHE_BUCKETS; i++) {
+        CacheEntry *entry = cache_buckets[i];
+        while (entry) {
+            CacheEntry *next = entry->next;
+            if (fp && entry->stored.segment >= 0) {
+                fprintf(fp, "%s\t%s\t%s\t%016llx\tsegment-%05d.warc\t%lld\t%zu\t%s\n",
+                        entry->url, entry->etag, entry->last_modified, entry->hash,
+                        entry->stored.segment, entry->stored.offset, entry->stored.len,
+                        entry->stored.gzip ? "gzip" : "raw");
+            } else if (fp) {
+                fprintf(fp, "%s\t%s\t%s\t%016llx\t\t\t\t\n", entry->url, entry->etag,
+                        entry->last_modified, entry->hash);
+            }
+            free(entry->url);
+            free(entry->etag);
+            free(entry->last_modified);
+            free(entry);
+            entry = next;
+        }
+        cache_buckets[i] = NULL;
+    }
+    if (fp) {
+        if (fclose(fp) != 0 || rename(tmp, path) == -1) {
+            fprintf(stderr, "Failed to save %s: %s\n", path, strerror(errno));
+            unlink(tmp);
+        }
+    }
+}
+
+// Turn what we know about url into conditional request headers
+void cache_request_headers(const char *url, ContentPipeline *content) {
+    char header[512];
+    pthread_mutex_lock(&cache_lock);
+    CacheEntry *entry = cache_find(url);
+    if (entry && entry->etag[0]) {
+        snprintf(header, sizeof(header), "If-None-Match: %s", entry->etag);
+        content->headers = curl_slist_append(content->headers, header);
+    }
+    if (entry && entry->last_modified[0]) {
+        snprintf(header, sizeof(header), "If-Modified-Since: %s", entry->last_modified);
+        content->headers = curl_slist_append(content->headers, header);
+    }
+    pthread_mutex_unlock(&cache_lock);
+}
+
+// Copy a header value, trimmed, into dst
+void copy_header_value(char *dst, size_t cap, const char *value, size_t len) {
+    while (len > 0 && (*value == ' ' || *value == '\t')) {
+        value++;
+        len--;
+    }
+    while (len > 0 && isspace((unsigned char)value[len - 1])) {
+        len--;
+    }
+    if (len >= cap) {
+        len = cap - 1;
+    }
+    memcpy(dst, value, len);
+    dst[len] = '\0';
+}
+
+// CURLOPT_HEADERFUNCTION: keep the validators. Every response in a
+// redirect chain starts with a status line, so only the last one counts.
+size_t read_header(char *buf, size_t size, size_t nitems, void *data) {
+    ContentPipeline *content = (ContentPipeline *)data;
+    size_t len = size * nitems;
+
+    if (len >= 5 && strncmp(buf, "HTTP/", 5) == 0) {
+        content->etag[0] = '\0';
+        content->last_modified[0] = '\0';
+    } else if (len > 5 && strncasecmp(buf, "etag:", 5) == 0) {
+        copy_header_value(content->etag, sizeof(content->etag), buf + 5, len - 5);
+    } else if (len > 14 && strncasecmp(buf, "last-modified:", 14) == 0) {
+        copy_header_value(content->last_modified, sizeof(content->last_modified),
+                          buf + 14, len - 14);
+    }
+    return len;
+}
+
+ContentPipeline *pipeline_open(UrlItem *item) {
+    ContentPipeline *content = malloc(sizeof(ContentPipeline));
+    if (!content) {
+        return NULL;
+    }
+    content->item = item;
+    content->opened = 0;
+    content->num_stages = 0;
+    content->bytes = 0;
+    content->hash = 14695981039346656037ULL;
+    content->stored.segment = -1;
+    content->etag[0] = '\0';
+    content->last_modified[0] = '\0';
+    content->headers = NULL;
+    content->rival = NULL;
+    return content;
+}
+
+// Throw away whatever the open stages have collected
+void pipeline_abort(ContentPipeline *content) {
+    for (int i = 0; i < content->num_stages; i++) {
+        config.stages[i]->abort(content->states[i]);
+    }
+    content->num_stages = 0;
+}
+
+// Instantiate every stage; on failure the ones already open are aborted
+int pipeline_start(ContentPipeline *content) {
+    content->opened = 1;
+    for (int i = 0; i < config.num_stages; i++) {
+        void *state = config.stages[i]->open(content->item);
+        if (!state) {
+            pipeline_abort(content);
+            return -1;
+        }
+        content->states[content->num_stages++] = state;
+    }
+    return 0;
+}
+
+// Close the stages into summary. An empty body still gets its outputs,
+// unless the server said it has not changed. Stages that only want good
+// pages are aborted when the response was not a success.
+void pipeline_close(ContentPipeline *content, int not_modified, int success,
+                    char *summary, size_t cap) {
+    summary[0] = '\0';
+    if (!content->opened && !not_modified && pipeline_start(content) != 0) {
+        append_summary(summary, cap, "no output");
+        return;
+    }
+    for (int i = 0; i < content->num_stages; i++) {
+        if (config.stages[i]->success_only && !success) {
+            config.stages[i]->abort(content->states[i]);
+        } else {
+            config.stages[i]->close(content->states[i], summary, cap, &content->stored);
+        }
+    }
+    content->num_stages = 0;
+    if (config.num_stages == 0) {
+        append_summary(summary, cap, "%zu bytes", content->bytes);
+    }
+}
+
+// Stages still open belong to an attempt nobody closed, such as the
+// losing copy of a hedged request
+void pipeline_free(ContentPipeline *content) {
+    pipeline_abort(content);
+    curl_slist_free_all(content->headers);
+    free(content);
+}
+
+// CURLOPT_WRITEFUNCTION: hand each chunk to every stage in turn while it
+// is still hot in cache, instead of writing it out and reading it back
+size_t write_chunk(void *ptr, size_t size, size_t nmemb, void *data) {
+    ContentPipeline *content = (ContentPipeline *)data;
+    size_t len = size * nmemb;
+
+    // The other copy of a hedged request answered first
+    if (content->rival && content->rival->opened) {
+        return 0;
+    }
+    if (!content->opened && pipeline_start(content) != 0) {
+        return 0;
+    }
+    if (config.cache_file) {
+        hash_write(&content->hash, ptr, len);
+    }
+    for (int i = 0; i < content->num_stages; i++) {
+        if (config.stages[i]->write(content->states[i], ptr, len) != 0) {
+            return 0; // Aborts the transfer with CURLE_WRITE_ERROR
+        }
+    }
+    content->bytes += len;
+    return len;
+}
+
+// curl_share lock callbacks: one mutex per kind of shared data
+void share_lock(CURL *curl, curl_lock_data data, curl_lock_access access, void *userp) {
+    (void)curl;
+    (void)access;
+    (void)userp;
+    pthread_mutex_lock(&share_locks[data]);
+}
+
+void share_unlock(CURL *curl, curl_lock_data data, void *userp) {
+    (void)curl;
+    (void)userp;
+    pthread_mutex_unlock(&share_locks[data]);
+}
+
+void init_share() {
+    for (int i = 0; i < CURL_LOCK_DATA_LAST; i++) {
+        pthread_mutex_init(&share_locks[i], NULL);
+    }
+    share = curl_share_init();
+    curl_share_setopt(share, CURLSHOPT_LOCKFUNC, share_lock);
+    curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, share_unlock);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+}
+
+void count_result(int ok) {
+    pthread_mutex_lock(&stats_lock);
+    if (ok) {
+        fetched_count++;
+    } else {
+        failed_count++;
+    }
+    pthread_mutex_unlock(&stats_lock);
+}
+
+int hist_buckets(int sub_bits) {
+    return (HIST_MAX_BITS - sub_bits + 1) << sub_bits;
+}
+
+int hist_index(long long value, int sub_bits) {
+    if (value < 0) {
+        value = 0;
+    }
+    if (value >= 1LL << HIST_MAX_BITS) {
+        value = (1LL << HIST_MAX_BITS) - 1;
+    }
+    if (value < 1 << sub_bits) {
+        return value;
+    }
+    int msb = 63 - __builtin_clzll(value);
+    int shift = msb - sub_bits;
+    return ((shift + 1) << sub_bits) + (int)(value >> shift) - (1 << sub_bits);
+}
+
+// Highest value that lands in bucket i
+long long hist_value(int i, int sub_bits) {
+    if (i < 1 << sub_bits) {
+        return i;
+    }
+    int shift = (i >> sub_bits) - 1;
+    long long mantissa = (i & ((1 << sub_bits) - 1)) + (1 << sub_bits);
+    return ((mantissa + 1) << shift) - 1;
+}
+
+void hist_init(Histogram *h, int sub_bits) {
+    memset(h, 0, sizeof(*h));
+    h->sub_bits = sub_bits;
+}
+
+unsigned int *hist_counts(Histogram *h) {
+    if (!h->counts) {
+        h->counts = calloc(hist_buckets(h->sub_bits), sizeof(unsigned int));
+        if (!h->counts) {
+            fprintf(stderr, "Memory allocation error\n");
+            exit(1);
+        }
+    }
+    return h->counts;
+}
+
+void hist_record(Histogram *h, long long value) {
+    hist_counts(h)[hist_index(value, h->sub_bits)]++;
+    h->total++;
+    h->sum += value;
+    if (value > h->max) {
+        h->max = value;
+    }
+}
+
+// Both histograms must have the same resolution
+void hist_merge(Histogram *into, const Histogram *from) {
+    if (!from->counts) {
+        return;
+    }
+    unsigned int *counts = hist_counts(into);
+    for (int i = 0; i < hist_buckets(from->sub_bits); i++) {
+        counts[i] += from->counts[i];
+    }
+    into->total += from->total;
+    into->sum += from->sum;
+    if (from->max > into->max) {
+        into->max = from->max;
+    }
+}
+
+// Value at quantile q (0..1), never above the largest recorded
+long long hist_percentile(const Histogram *h, double q) {
+    if (h->total == 0) {
+        return 0;
+    }
+    long rank = (long)(q * h->total + 0.999999);
+    if (rank < 1) {
+        rank = 1;
+    }
+    long seen = 0;
+    for (int i = 0; i < hist_buckets(h->sub_bits); i++) {
+        seen += h->counts[i];
+        if (seen >= rank) {
+            long long value = hist_value(i, h->sub_bits);
+            return value < h->max ? value : h->max;
+        }
+    }
+    return h->max;
+}
+
+// Learn a host's time to first byte, refreshing its hedge delay now and
+// then rather than walking the histogram on every response
+void host_observe(Host *host, long long ttfb) {
+    pthread_mutex_lock(&sched.lock);
+    if (!host->ttfb) {
+        host->ttfb = malloc(sizeof(Histogram));
+        if (host->ttfb) {
+            hist_init(host->ttfb, HOST_HIST_SUB_BITS);
+        }
+    }
+    if (host->ttfb) {
+        hist_record(host->ttfb, ttfb);
+        if (host->ttfb->total >= HEDGE_MIN_SAMPLES && host->ttfb->total % 16 == 4) {
+            host->hedge_after = hist_percentile(host->ttfb, config.hedge_percentile / 100) / 1e6;
+        }
+    }
+    pthread_mutex_unlock(&sched.lock);
+}
+
+// When to send a duplicate of a transfer starting now, 0 for never
+double hedge_deadline(UrlItem *item) {
+    if (config.hedge_percentile <= 0) {
+        return 0;
+    }
+    pthread_mutex_lock(&sched.lock);
+    double after = item->host->hedge_after;
+    pthread_mutex_unlock(&sched.lock);
+    return after > 0 ? now_seconds() + after : 0;
+}
+
+HostMetrics *new_host_metrics(struct Host *host, int sub_bits) {
+    HostMetrics *m = calloc(1, sizeof(HostMetrics));
+    if (!m) {
+        fprintf(stderr, "Memory allocation error\n");
+        exit(1);
+    }
+    m->host = host;
+    for (int t = 0; t < NUM_TIMINGS; t++) {
+        hist_init(&m->timings[t], sub_bits);
+    }
+    return m;
+}
+
+void free_host_metrics(HostMetrics *m) {
+    for (int t = 0; t < NUM_TIMINGS; t++) {
+        free(m->timings[t].counts);
+    }
+    free(m);
+}
 
-size_t write_to_string(void *ptr, size_t size, size_t nmemb, void *data) {
-    FILE *fp = (FILE *)data;
-    return fwrite(ptr, size, nmemb, fp);
+// Everything record_metrics counts, from one entry into another
+void merge_host_metrics(HostMetrics *into, const HostMetrics *from) {
+    into->requests += from->requests;
+    for (int s = 0; s < 6; s++) {
+        into->status[s] += from->status[s];
+    }
+    into->bytes += from->bytes;
+    for (int t = 0; t < NUM_TIMINGS; t++) {
+        hist_merge(&into->timings[t], &from->timings[t]);
+    }
 }
 
-void *fetch_url(void *arg) {
-    ThreadData *tdata = (ThreadData *)arg;
-    CURL *curl;
-    CURLcode res;
+// The calling thread's entry for host, created on first use
+HostMetrics *thread_host_metrics(struct Host *host) {
+    if (!thread_metrics) {
+        thread_metrics = calloc(1, sizeof(MetricsTable));
+        if (!thread_metrics) {
+            fprintf(stderr, "Memory allocation error\n");
+            exit(1);
+        }
+        thread_metrics->all = new_host_metrics(NULL, HIST_SUB_BITS);
+        pthread_mutex_lock(&metrics_lock);
+        thread_metrics->next = metrics_tables;
+        metrics_tables = thread_metrics;
+        pthread_mutex_unlock(&metrics_lock);
+    }
+    unsigned long bucket = ((unsigned long)host >> 4) % METRIC_BUCKETS;
+    HostMetrics *m = thread_metrics->buckets[bucket];
+    while (m && m->host != host) {
+        m = m->next;
+    }
+    if (!m) {
+        m = new_host_metrics(host, HOST_HIST_SUB_BITS);
+        m->next = thread_metrics->buckets[bucket];
+        thread_metrics->buckets[bucket] = m;
+    }
+    return m;
+}
+
+// Record the phases of a finished transfer. curl reports each phase as
+// time since the start, so they are differenced; connection setup only
+// counts when this transfer opened a connection.
+void record_metrics(CURL *curl, UrlItem *item, CURLcode res, long code,
+                    long connects, curl_off_t downloaded) {
+    curl_off_t dns = 0, connect = 0, tls = 0, ttfb = 0, total = 0;
+    curl_easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME_T, &dns);
+    curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME_T, &connect);
+    curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME_T, &tls);
+    curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME_T, &ttfb);
+    curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &total);
+
+    HostMetrics *entries[2] = { thread_host_metrics(item->host), thread_metrics->all };
+    for (int i = 0; i < 2; i++) {
+        HostMetrics *m = entries[i];
+        m->requests++;
+        m->status[res == CURLE_OK && code >= 100 && code < 600 ? code / 100 : 0]++;
+        m->bytes += downloaded;
+        if (connects > 0 && connect > 0) {
+            hist_record(&m->timings[TIME_DNS], dns);
+            hist_record(&m->timings[TIME_CONNECT], connect - dns);
+            if (tls > 0) {
+                hist_record(&m->timings[TIME_TLS], tls - connect);
+            }
+        }
+        if (res == CURLE_OK) {
+            hist_record(&m->timings[TIME_TTFB], ttfb);
+        }
+        hist_record(&m->timings[TIME_TOTAL], total);
+    }
+    if (res == CURLE_OK && config.hedge_percentile > 0) {
+        host_observe(item->host, ttfb);
+    }
+}
+
+// Fold every thread's table into one entry per host, and their totals
+// into all, freeing the tables. Returns the hosts as an array; *count
+// gets its length.
+HostMetrics **merge_metrics(int *count, HostMetrics *all) {
+    MetricsTable merged;
+    memset(&merged, 0, sizeof(merged));
+    int hosts = 0;
+
+    MetricsTable *table = metrics_tables;
+    while (table) {
+        for (int i = 0; i < METRIC_BUCKETS; i++) {
+            HostMetrics *m = table->buckets[i];
+            while (m) {
+                HostMetrics *next = m->next;
+                HostMetrics *into = merged.buckets[i];
+                while (into && into->host != m->host) {
+                    into = into->next;
+                }
+                if (!into) {
+                    m->next = merged.buckets[i];
+                    merged.buckets[i] = m;
+                    hosts++;
+                } else {
+                    merge_host_metrics(into, m);
+                    free_host_metrics(m);
+                }
+                m = next;
+            }
+        }
+        merge_host_metrics(all, table->all);
+        free_host_metrics(table->all);
+        MetricsTable *next = table->next;
+        free(table);
+        table = next;
+    }
+    metrics_tables = NULL;
+
+    HostMetrics **list = malloc((hosts + 1) * sizeof(HostMetrics *));
+    if (!list) {
+        fprintf(stderr, "Memory allocation error\n");
+        exit(1);
+    }
+    int n = 0;
+    for (int i = 0; i < METRIC_BUCKETS; i++) {
+        for (HostMetrics *m = merged.buckets[i]; m; m = m->next) {
+            list[n++] = m;
+        }
+    }
+    *count = n;
+    return list;
+}
+
+int compare_slowest(const void *a, const void *b) {
+    long long pa = hist_percentile(&(*(HostMetrics **)a)->timings[TIME_TOTAL], 0.99);
+    long long pb = hist_percentile(&(*(HostMetrics **)b)->timings[TIME_TOTAL], 0.99);
+    return pa < pb ? 1 : pa > pb ? -1 : 0;
+}
+
+void print_latency(const char *label, const char *phase, const Histogram *h) {
+    fprintf(stderr, "  %-28.28s %-8s %7ld %9.1f %9.1f %9.1f %9.1f\n", label, phase, h->total,
+            hist_percentile(h, 0.50) / 1000.0, hist_percentile(h, 0.90) / 1000.0,
+            hist_percentile(h, 0.99) / 1000.0, h->max / 1000.0);
+}
+
+// Every phase across all hosts, then total time for the hosts with the
+// worst p99
+void print_metrics(HostMetrics **hosts, int count, HostMetrics *all) {
+    fprintf(stderr, "Latency (ms)                 phase      count       p50       p90"
+            "       p99       max\n");
+    for (int t = 0; t < NUM_TIMINGS; t++) {
+        if (all->timings[t].total > 0) {
+            print_latency("all hosts", timing_names[t], &all->timings[t]);
+        }
+    }
+    qsort(hosts, count, sizeof(HostMetrics *), compare_slowest);
+    for (int i = 0; i < count && i < SLOWEST_HOSTS; i++) {
+        print_latency(hosts[i]->host->key, "total", &hosts[i]->timings[TIME_TOTAL]);
+    }
+    if (count > SLOWEST_HOSTS) {
+        fprintf(stderr, "  (%d more hosts in the metrics file)\n", count - SLOWEST_HOSTS);
+    }
+}
+
+// Host keys are host:port, but quote anything a URL could carry
+void write_escaped(FILE *fp, const char *text) {
+    for (const char *c = text; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            fputc('\\', fp);
+        }
+        if ((unsigned char)*c >= 0x20) {
+            fputc(*c, fp);
+        }
+    }
+}
+
+const char *status_names[6] = { "error", "1xx", "2xx", "3xx", "4xx", "5xx" };
+
+void write_json_host(FILE *fp, HostMetrics *m, const char *name) {
+    fprintf(fp, "    {\"host\": \"");
+    write_escaped(fp, name);
+    fprintf(fp, "\", \"requests\": %ld, \"bytes\": %lld, \"status\": {", m->requests, m->bytes);
+    for (int s = 0; s < 6; s++) {
+        fprintf(fp, "%s\"%s\": %ld", s ? ", " : "", status_names[s], m->status[s]);
+    }
+    fprintf(fp, "},\n     \"timings_us\": {");
+    for (int t = 0; t < NUM_TIMINGS; t++) {
+        Histogram *h = &m->timings[t];
+        fprintf(fp, "%s\n       \"%s\": {\"count\": %ld, \"sum\": %lld, \"p50\": %lld, "
+                "\"p90\": %lld, \"p99\": %lld, \"max\": %lld}", t ? "," : "", timing_names[t],
+                h->total, h->sum, hist_percentile(h, 0.50), hist_percentile(h, 0.90),
+                hist_percentile(h, 0.99), h->max);
+    }
+    fprintf(fp, "}}");
+}
 
-    char filename[256];
-    snprintf(filename, sizeof(filename), "output_%d.txt", tdata->index);
+void write_prometheus_host(FILE *fp, HostMetrics *m) {
+    const double quantiles[] = { 0.5, 0.9, 0.99 };
+    for (int t = 0; t < NUM_TIMINGS; t++) {
+        Histogram *h = &m->timings[t];
+        if (h->total == 0) {
+            continue;
+        }
+        for (int q = 0; q < 3; q++) {
+            fprintf(fp, "scraper_transfer_seconds{host=\"");
+            write_escaped(fp, m->host->key);
+            fprintf(fp, "\",phase=\"%s\",quantile=\"%g\"} %.6f\n", timing_names[t],
+                    quantiles[q], hist_percentile(h, quantiles[q]) / 1e6);
+        }
+        fprintf(fp, "scraper_transfer_seconds_sum{host=\"");
+        write_escaped(fp, m->host->key);
+        fprintf(fp, "\",phase=\"%s\"} %.6f\n", timing_names[t], h->sum / 1e6);
+        fprintf(fp, "scraper_transfer_seconds_count{host=\"");
+        write_escaped(fp, m->host->key);
+        fprintf(fp, "\",phase=\"%s\"} %ld\n", timing_names[t], h->total);
+        fprintf(fp, "scraper_transfer_max_seconds{host=\"");
+        write_escaped(fp, m->host->key);
+        fprintf(fp, "\",phase=\"%s\"} %.6f\n", timing_names[t], h->max / 1e6);
+    }
+    for (int s = 0; s < 6; s++) {
+        if (m->status[s] > 0) {
+            fprintf(fp, "scraper_responses_total{host=\"");
+            write_escaped(fp, m->host->key);
+            fprintf(fp, "\",status=\"%s\"} %ld\n", status_names[s], m->status[s]);
+        }
+    }
+    fprintf(fp, "scraper_downloaded_bytes_total{host=\"");
+    write_escaped(fp, m->host->key);
+    fprintf(fp, "\"} %lld\n", m->bytes);
+}
 
-    FILE *fp = fopen(filename, "w");
+// JSON when the name ends in .json, Prometheus text format otherwise
+void write_metrics(const char *path, HostMetrics **hosts, int count, HostMetrics *all) {
+    FILE *fp = fopen(path, "w");
     if (!fp) {
-        fprintf(stderr, "Error opening file %s\n", filename);
-        pthread_exit(NULL);
+        fprintf(stderr, "Failed to write %s: %s\n", path, strerror(errno));
+        return;
+    }
+    size_t len = strlen(path);
+    if (len >= 5 && strcmp(path + len - 5, ".json") == 0) {
+        fprintf(fp, "{\n  \"all\":\n");
+        write_json_host(fp, all, "all");
+        fprintf(fp, ",\n  \"hosts\": [\n");
+        for (int i = 0; i < count; i++) {
+            write_json_host(fp, hosts[i], hosts[i]->host->key);
+            fprintf(fp, "%s\n", i + 1 < count ? "," : "");
+        }
+        fprintf(fp, "  ]\n}\n");
+    } else {
+        fprintf(fp, "# HELP scraper_transfer_seconds Transfer time by phase\n"
+                "# TYPE scraper_transfer_seconds summary\n"
+                "# HELP scraper_transfer_max_seconds Slowest transfer by phase\n"
+                "# TYPE scraper_transfer_max_seconds gauge\n"
+                "# HELP scraper_responses_total Responses by status class\n"
+                "# TYPE scraper_responses_total counter\n"
+                "# HELP scraper_downloaded_bytes_total Body bytes downloaded\n"
+                "# TYPE scraper_downloaded_bytes_total counter\n");
+        for (int i = 0; i < count; i++) {
+            write_prometheus_host(fp, hosts[i]);
+        }
+    }
+    if (fclose(fp) != 0) {
+        fprintf(stderr, "Failed to write %s: %s\n", path, strerror(errno));
+    }
+}
+
+// Merge, summarize and export the metrics once every thread is done
+void report_metrics() {
+    int count;
+    HostMetrics *all = new_host_metrics(NULL, HIST_SUB_BITS);
+    HostMetrics **hosts = merge_metrics(&count, all);
+
+    if (count > 0) {
+        print_metrics(hosts, count, all);
+    }
+    if (config.metrics_file) {
+        write_metrics(config.metrics_file, hosts, count, all);
+    }
+
+    for (int i = 0; i < count; i++) {
+        free_host_metrics(hosts[i]);
     }
+    free(hosts);
+    free_host_metrics(all);
+}
+
+// Point a new or recycled handle at url. curl_easy_reset clears the
+// options but keeps the handle's connection and DNS caches, so the next
+// request to the same host skips the TCP, TLS and DNS round trips.
+CURL *setup_easy(CURL *curl, char *url, ContentPipeline *content) {
+    if (curl == NULL) {
+        curl = curl_easy_init();
+        if (!curl) {
+            fprintf(stderr, "Failed to init curl for %s\n", url);
+            return NULL;
+        }
+    } else {
+        curl_easy_reset(curl);
+    }
+    curl_easy_setopt(curl, CURLOPT_URL, url);
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_chunk);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, content);
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L); // Follow redirects
+    curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L); // Required with threads
+    // A stalled server must not hold a worker or an output file forever
+    if (config.connect_timeout > 0) {
+        curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, config.connect_timeout);
+    }
+    if (config.total_timeout > 0) {
+        curl_easy_setopt(curl, CURLOPT_TIMEOUT, config.total_timeout);
+    }
+    if (config.low_speed_limit > 0 && config.low_speed_time > 0) {
+        curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, config.low_speed_limit);
+        curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, config.low_speed_time);
+    }
+    if (config.fresh) {
+        curl_easy_setopt(curl, CURLOPT_FORBID_REUSE, 1L);
+    } else {
+        curl_easy_setopt(curl, CURLOPT_SHARE, share);
+        // The shared pool is trimmed to the returning handle's limit,
+        // which defaults to 5; keep one idle connection per worker
+        long max_connects = config.engine == ENGINE_MULTI ? config.concurrency : config.workers;
+        curl_easy_setopt(curl, CURLOPT_MAXCONNECTS, max_connects < 5 ? 5 : max_connects);
+    }
+    if (config.cache_file) {
+        cache_request_headers(url, content);
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, content->headers);
+        curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, read_header);
+        curl_easy_setopt(curl, CURLOPT_HEADERDATA, content);
+    }
+    return curl;
+}
+
+// Failures that may pass if we try again a little later
+int is_transient(CURLcode res, long code) {
+    switch (res) {
+        case CURLE_OK:
+            return code == 408 || code == 500 || code == 502 || code == 504;
+        case CURLE_COULDNT_RESOLVE_HOST:
+        case CURLE_COULDNT_CONNECT:
+        case CURLE_OPERATION_TIMEDOUT:
+        case CURLE_SEND_ERROR:
+        case CURLE_RECV_ERROR:
+        case CURLE_GOT_NOTHING:
+        case CURLE_PARTIAL_FILE:
+        case CURLE_SSL_CONNECT_ERROR:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+// Close the pipeline and report a finished transfer, or hand it back to
+// the scheduler when the host throttled us or the failure looks transient. The pipeline is freed, and
+// the item too unless it was requeued.
+void complete_transfer(CURL *curl, UrlItem *item, ContentPipeline *content, CURLcode res) {
+    // A transfer that opened no new connection rode on a kept-alive one
+    long connects = 0;
+    curl_off_t downloaded = 0;
+    curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &connects);
+    curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &downloaded);
 
-    curl = curl_easy_init();
-    if (curl) {
-        curl_easy_setopt(curl, CURLOPT_URL, tdata->url);
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_to_string);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, fp);
-        curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L); // Follow redirects
+    pthread_mutex_lock(&stats_lock);
+    connections_opened += connects;
+    if (connects == 0 && res == CURLE_OK) {
+        connections_reused++;
+    }
+    bytes_downloaded += downloaded;
+    pthread_mutex_unlock(&stats_lock);
+
+    long code = 0;
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+    record_metrics(curl, item, res, code, connects, downloaded);
+    int not_modified = res == CURLE_OK && code == 304;
 
-        res = curl_easy_perform(curl);
+    // An attempt that will be retried leaves no output behind: its stages
+    // are aborted by pipeline_free, so only the final attempt is stored,
+    // listed or crawled
+    if (res == CURLE_OK && (code == 429 || code == 503) && config.honor_retry &&
+        ++item->attempts < config.max_attempts) {
+        curl_off_t retry_after = 0;
+        curl_easy_getinfo(curl, CURLINFO_RETRY_AFTER, &retry_after);
+        double delay = sched_retry(&sched, item, (long)retry_after);
+        fprintf(stderr, "Throttled by %s (HTTP %ld), retrying %s in %.1fs\n",
+                item->host->key, code, item->url, delay);
+        pipeline_free(content);
+        return;
+    }
+    if (is_transient(res, code) && ++item->attempts < config.max_attempts) {
+        double delay = sched_defer(&sched, item);
+        char reason[64];
         if (res != CURLE_OK) {
-            fprintf(stderr, "Failed to fetch %s: %s\n", tdata->url, curl_easy_strerror(res));
+            snprintf(reason, sizeof(reason), "%s", curl_easy_strerror(res));
+        } else {
+            snprintf(reason, sizeof(reason), "HTTP %ld", code);
+        }
+        fprintf(stderr, "Retrying %s in %.1fs (%s, attempt %d of %d)\n", item->url, delay,
+                reason, item->attempts + 1, config.max_attempts);
+        pthread_mutex_lock(&stats_lock);
+        retries++;
+        pthread_mutex_unlock(&stats_lock);
+        pipeline_free(content);
+        return;
+    }
+
+    char summary[SUMMARY_LENGTH];
+    pipeline_close(content, not_modified, res == CURLE_OK && code >= 200 && code < 300,
+                   summary, sizeof(summary));
+    if (res != CURLE_OK) {
+        fprintf(stderr, "Failed to fetch %s: %s\n", item->url, curl_easy_strerror(res));
+    } else if (not_modified) {
+        pthread_mutex_lock(&cache_lock);
+        CacheEntry *entry = cache_find(item->url);
+        StoreRecord stored = { -1, 0, 0, 0 };
+        if (entry) {
+            stored = entry->stored;
+        }
+        cache_hits++;
+        pthread_mutex_unlock(&cache_lock);
+
+        if (stored.segment >= 0) {
+            snprintf(summary, sizeof(summary), "segment-%05d.warc @ %lld", stored.segment,
+                     stored.offset);
+            if (config.max_depth > 0) {
+                crawl_stored(item, &stored, summary, sizeof(summary));
+            }
+        } else {
+            snprintf(summary, sizeof(summary), "unknown");
+        }
+        printf("Not modified: %s (cached at %s)\n", item->url, summary);
+    } else {
+        printf("Successfully fetched: %s -> %s\n", item->url, summary);
+        if (config.cache_file) {
+            pthread_mutex_lock(&cache_lock);
+            if (code == 200 && (content->etag[0] || content->last_modified[0])) {
+                cache_put(item->url, content->etag, content->last_modified,
+                          content->hash, &content->stored);
+            }
+            cache_misses++;
+            pthread_mutex_unlock(&cache_lock);
+        }
+    }
+    count_result(res == CURLE_OK);
+    pipeline_free(content);
+
+    sched_release(&sched, item, res == CURLE_OK);
+    free(item->url);
+    free(item);
+}
+
+// The transfer has gone past its host's latency percentile without a
+// byte of body: send a duplicate on spare (or a new handle). Returns the
+// duplicate's handle to add, or NULL when it is not worth sending.
+CURL *start_hedge(Transfer *t, CURL *spare) {
+    t->hedge_at = 0;
+    if (t->content->opened) {
+        return NULL;    // Already streaming; a copy could only lose
+    }
+    pthread_mutex_lock(&stats_lock);
+    int within_budget = hedges_sent * HEDGE_BUDGET < fetched_count + failed_count + HEDGE_BUDGET;
+    if (within_budget) {
+        hedges_sent++;
+    }
+    pthread_mutex_unlock(&stats_lock);
+    if (!within_budget) {
+        return NULL;
+    }
+
+    ContentPipeline *content = pipeline_open(t->item);
+    if (!content) {
+        return NULL;
+    }
+    CURL *curl = setup_easy(config.fresh ? NULL : spare, t->item->url, content);
+    if (!curl) {
+        pipeline_free(content);
+        return NULL;
+    }
+    curl_easy_setopt(curl, CURLOPT_PRIVATE, t);
+    content->rival = t->content;
+    t->content->rival = content;
+    t->hedge = curl;
+    t->hedge_content = content;
+    return curl;
+}
+
+// One handle of t finished with res. Returns 1 when that settles the
+// transfer, which then holds the winning handle and pipeline, or 0 when
+// the other copy carries on. *loser gets the handle that is no longer
+// needed, for the caller to remove from its multi handle and recycle.
+int settle_transfer(Transfer *t, CURL *finished, CURLcode res, CURL **loser) {
+    *loser = NULL;
+    if (!t->hedge) {
+        return 1;
+    }
+    int primary = finished == t->curl;
+    ContentPipeline *mine = primary ? t->content : t->hedge_content;
+    ContentPipeline *theirs = primary ? t->hedge_content : t->content;
+    CURL *other = primary ? t->hedge : t->curl;
+    mine->rival = NULL;
+    theirs->rival = NULL;
+    t->hedge = NULL;
+    t->hedge_content = NULL;
+
+    // A failure before any body was written leaves the other copy a chance
+    int won = res == CURLE_OK || mine->opened;
+    if (won) {
+        pipeline_free(theirs);
+        *loser = other;
+        t->curl = finished;
+        t->content = mine;
+        if (!primary) {
+            pthread_mutex_lock(&stats_lock);
+            hedges_won++;
+            pthread_mutex_unlock(&stats_lock);
+        }
+    } else {
+        pipeline_free(mine);
+        *loser = finished;
+        t->curl = other;
+        t->content = theirs;
+    }
+    return won;
+}
+
+// Run t on the worker's private multi handle so a duplicate can race it
+CURLcode perform_hedged(FetchWorker *w, Transfer *t) {
+    curl_multi_add_handle(w->multi, t->curl);
+    while (1) {
+        int running;
+        curl_multi_perform(w->multi, &running);
+
+        CURLMsg *msg;
+        int left;
+        while ((msg = curl_multi_info_read(w->multi, &left)) != NULL) {
+            if (msg->msg != CURLMSG_DONE) {
+                continue;
+            }
+            CURL *finished = msg->easy_handle;
+            CURLcode res = msg->data.result;
+            curl_multi_remove_handle(w->multi, finished);
+
+            CURL *loser;
+            int settled = settle_transfer(t, finished, res, &loser);
+            if (loser) {
+                curl_multi_remove_handle(w->multi, loser);
+                if (w->spare) {
+                    curl_easy_cleanup(w->spare);
+                }
+                w->spare = loser;
+            }
+            if (settled) {
+                return res;
+            }
+        }
+
+        int timeout_ms = 1000;
+        if (t->hedge_at > 0) {
+            double wait = t->hedge_at - now_seconds();
+            if (wait <= 0) {
+                CURL *hedge = start_hedge(t, w->spare);
+                if (hedge) {
+                    if (hedge == w->spare) {
+                        w->spare = NULL;
+                    }
+                    curl_multi_add_handle(w->multi, hedge);
+                }
+                continue;
+            }
+            timeout_ms = (int)(wait * 1000) + 1;
+        }
+        curl_multi_poll(w->multi, NULL, 0, timeout_ms, NULL);
+    }
+}
+
+// Fetch a URL through the content pipeline with the worker's handle,
+// which may be replaced by a fresh one or by a winning duplicate
+void fetch_url(FetchWorker *w, UrlItem *item) {
+    Transfer t;
+    t.item = item;
+    t.hedge = NULL;
+    t.hedge_content = NULL;
+    t.content = pipeline_open(item);
+    if (!t.content) {
+        count_result(0);
+        sched_release(&sched, item, 0);
+        free(item->url);
+        free(item);
+        return;
+    }
+
+    if (config.fresh && w->curl != NULL) {
+        curl_easy_cleanup(w->curl);
+        w->curl = NULL;
+    }
+
+    t.curl = setup_easy(w->curl, item->url, t.content);
+    w->curl = t.curl;
+    if (t.curl) {
+        CURLcode res;
+        t.hedge_at = w->multi ? hedge_deadline(item) : 0;
+        if (t.hedge_at > 0) {
+            res = perform_hedged(w, &t);
+            w->curl = t.curl;
         } else {
-            printf("Successfully fetched: %s -> %s\n", tdata->url, filename);
+            res = curl_easy_perform(t.curl);
+        }
+        complete_transfer(t.curl, item, t.content, res);
+    } else {
+        pipeline_free(t.content);
+        count_result(0);
+        sched_release(&sched, item, 0);
+        free(item->url);
+        free(item);
+    }
+}
+
+// Each worker fetches URLs the scheduler hands out until the reader is
+// done, keeping its easy handles for its whole life
+void *worker_main(void *arg) {
+    (void)arg;
+    UrlItem *item;
+    FetchWorker w;
+    w.curl = NULL;
+    w.spare = NULL;
+    w.multi = config.hedge_percentile > 0 ? curl_multi_init() : NULL;
+
+    while ((item = sched_pop(&sched)) != NULL) {
+        fetch_url(&w, item);
+    }
+    if (w.curl) {
+        curl_easy_cleanup(w.curl);
+    }
+    if (w.spare) {
+        curl_easy_cleanup(w.spare);
+    }
+    if (w.multi) {
+        curl_multi_cleanup(w.multi);
+    }
+    return NULL;
+}
+
+// Run the thread pool: stream URLs from fp into the scheduler
+long run_threads(Config *config, FILE *fp) {
+    pthread_t *threads = malloc(config->workers * sizeof(pthread_t));
+    if (!threads) {
+        fprintf(stderr, "Memory allocation error\n");
+        exit(1);
+    }
+
+    int started_workers = 0;
+    for (int i = 0; i < config->workers; ++i) {
+        if (pthread_create(&threads[started_workers], NULL, worker_main, NULL) != 0) {
+            fprintf(stderr, "Failed to create worker thread %d\n", i);
+            continue;
+        }
+        started_workers++;
+    }
+    if (started_workers == 0) {
+        fprintf(stderr, "No worker threads could be started\n");
+        exit(1);
+    }
+    config->workers = started_workers;
+
+    // Stream URLs into the pool; the whole list is never held in memory
+    char *url;
+    while ((url = next_url(fp)) != NULL) {
+        enqueue_seed(url);
+    }
+    sched_close(&sched);
+
+    for (int i = 0; i < started_workers; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    return url_total;
+}
+
+// Next non-blank line of the URL file as a malloc'd string, or NULL at EOF
+char *next_url(FILE *fp) {
+    static char *line = NULL;
+    static size_t line_cap = 0;
+
+    while (getline(&line, &line_cap, fp) != -1) {
+        line[strcspn(line, "\r\n")] = 0; // Remove newline
+        if (line[0] == '\0') {
+            continue;
+        }
+        char *url = strdup(line);
+        if (!url) {
+            fprintf(stderr, "Memory allocation error\n");
+            exit(1);
+        }
+        return url;
+    }
+    free(line);
+    line = NULL;
+    line_cap = 0;
+    return NULL;
+}
+
+// CURLMOPT_SOCKETFUNCTION: mirror curl's interest in a socket into epoll
+int socket_callback(CURL *curl, curl_socket_t s, int what, void *userp, void *socketp) {
+    (void)curl;
+    EventLoop *loop = (EventLoop *)userp;
+
+    if (what == CURL_POLL_REMOVE) {
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, s, NULL);
+        curl_multi_assign(loop->multi, s, NULL);
+        return 0;
+    }
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.data.fd = s;
+    if (what == CURL_POLL_IN || what == CURL_POLL_INOUT) {
+        ev.events |= EPOLLIN;
+    }
+    if (what == CURL_POLL_OUT || what == CURL_POLL_INOUT) {
+        ev.events |= EPOLLOUT;
+    }
+
+    // socketp is non-NULL once the socket has been added
+    if (socketp) {
+        epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, s, &ev);
+    } else {
+        if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, s, &ev) == -1 && errno == EEXIST) {
+            epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, s, &ev);
         }
+        curl_multi_assign(loop->multi, s, loop);
+    }
+    return 0;
+}
+
+// CURLMOPT_TIMERFUNCTION: curl wants a timeout action after timeout_ms
+int timer_callback(CURLM *multi, long timeout_ms, void *userp) {
+    (void)multi;
+    EventLoop *loop = (EventLoop *)userp;
+    loop->timeout_ms = timeout_ms;
+    return 0;
+}
+
+// Start the transfer for a scheduled URL, or count it failed
+int add_transfer(EventLoop *loop, UrlItem *item) {
+    Transfer *t = malloc(sizeof(Transfer));
+    if (!t) {
+        fprintf(stderr, "Memory allocation error\n");
+        exit(1);
+    }
+    t->item = item;
+    t->hedge = NULL;
+    t->hedge_content = NULL;
+    t->content = pipeline_open(item);
+    if (!t->content) {
+        count_result(0);
+        sched_release(&sched, item, 0);
+        free(item->url);
+        free(item);
+        free(t);
+        return 0;
+    }
+
+    // Recycle a finished handle when there is one
+    CURL *curl = NULL;
+    if (loop->num_idle > 0 && !config.fresh) {
+        curl = loop->idle[--loop->num_idle];
+    }
+    t->curl = setup_easy(curl, item->url, t->content);
+    if (!t->curl) {
+        count_result(0);
+        pipeline_free(t->content);
+        sched_release(&sched, item, 0);
+        free(item->url);
+        free(item);
+        free(t);
+        return 0;
+    }
+    curl_easy_setopt(t->curl, CURLOPT_PRIVATE, t);
+    curl_multi_add_handle(loop->multi, t->curl);
+    t->hedge_at = hedge_deadline(item);
+
+    t->prev = NULL;
+    t->next = loop->transfers;
+    if (loop->transfers) {
+        loop->transfers->prev = t;
+    }
+    loop->transfers = t;
+    return 1;
+}
 
+void recycle_handle(EventLoop *loop, CURL *curl) {
+    if (config.fresh) {
         curl_easy_cleanup(curl);
     } else {
-        fprintf(stderr, "Failed to init curl for %s\n", tdata->url);
+        loop->idle[loop->num_idle++] = curl;
     }
+}
 
-    fclose(fp);
-    pthread_exit(NULL);
+// Send duplicates of transfers that are past their hedge time; returns
+// the next hedge time still ahead, 0 for none
+double start_due_hedges(EventLoop *loop) {
+    double now = now_seconds();
+    double next = 0;
+    for (Transfer *t = loop->transfers; t; t = t->next) {
+        if (t->hedge_at <= 0) {
+            continue;
+        }
+        if (t->hedge_at <= now) {
+            CURL *spare = loop->num_idle > 0 ? loop->idle[--loop->num_idle] : NULL;
+            CURL *hedge = start_hedge(t, spare);
+            if (hedge) {
+                curl_multi_add_handle(loop->multi, hedge);
+            }
+            if (spare && hedge != spare) {
+                recycle_handle(loop, spare);
+            }
+        } else if (next == 0 || t->hedge_at < next) {
+            next = t->hedge_at;
+        }
+    }
+    return next;
+}
+
+// Retire finished transfers; returns how many completed
+int drain_completed(EventLoop *loop) {
+    CURLMsg *msg;
+    int pending;
+    int done = 0;
+
+    while ((msg = curl_multi_info_read(loop->multi, &pending)) != NULL) {
+        if (msg->msg != CURLMSG_DONE) {
+            continue;
+        }
+        Transfer *t;
+        CURL *finished = msg->easy_handle;
+        curl_easy_getinfo(finished, CURLINFO_PRIVATE, (char **)&t);
+        CURLcode res = msg->data.result;
+        curl_multi_remove_handle(loop->multi, finished);
+
+        CURL *loser;
+        int settled = settle_transfer(t, finished, res, &loser);
+        if (loser) {
+            curl_multi_remove_handle(loop->multi, loser);
+            recycle_handle(loop, loser);
+        }
+        if (!settled) {
+            continue;
+        }
+        complete_transfer(t->curl, t->item, t->content, res);
+        recycle_handle(loop, t->curl);
+
+        if (t->prev) {
+            t->prev->next = t->next;
+        } else {
+            loop->transfers = t->next;
+        }
+        if (t->next) {
+            t->next->prev = t->prev;
+        }
+        free(t);
+        done++;
+    }
+    return done;
+}
+
+// Run every transfer from one thread. curl tells us which sockets and
+// timeouts it cares about; epoll wakes us only when one of them is ready,
+// so thousands of slow transfers cost no threads and no polling.
+long run_multi(Config *config, FILE *fp) {
+    EventLoop loop;
+    loop.timeout_ms = -1;
+    loop.num_idle = 0;
+    loop.transfers = NULL;
+    // Room for every transfer's handle and its hedge
+    loop.idle = malloc(2 * config->concurrency * sizeof(CURL *));
+    if (!loop.idle) {
+        fprintf(stderr, "Memory allocation error\n");
+        exit(1);
+    }
+    loop.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop.epoll_fd == -1) {
+        perror("epoll_create1");
+        exit(1);
+    }
+
+    loop.multi = curl_multi_init();
+    curl_multi_setopt(loop.multi, CURLMOPT_SOCKETFUNCTION, socket_callback);
+    curl_multi_setopt(loop.multi, CURLMOPT_SOCKETDATA, &loop);
+    curl_multi_setopt(loop.multi, CURLMOPT_TIMERFUNCTION, timer_callback);
+    curl_multi_setopt(loop.multi, CURLMOPT_TIMERDATA, &loop);
+
+    struct epoll_event events[MAX_EVENTS];
+    int in_flight = 0;
+    int input_done = 0;
+    int running;
+
+    while (1) {
+        // Keep the scheduler stocked, reading only as far as needed
+        while (!input_done && sched.pending < QUEUE_CAPACITY) {
+            char *url = next_url(fp);
+            if (url == NULL) {
+                input_done = 1;
+                break;
+            }
+            enqueue_seed(url);
+        }
+
+        // Top up to the concurrency limit with whatever hosts allow
+        double wake_at = 0;
+        UrlItem *item;
+        while (in_flight < config->concurrency &&
+               (item = sched_try_pop(&sched, &wake_at)) != NULL) {
+            in_flight += add_transfer(&loop, item);
+        }
+        if (in_flight == 0 && input_done && sched.pending == 0) {
+            break;
+        }
+
+        // Sleep until a socket is ready, curl's timer fires, a throttled
+        // host may send again, or a transfer is due a hedge
+        long timeout_ms = loop.timeout_ms;
+        double hedge_at = start_due_hedges(&loop);
+        if (wake_at > 0 && in_flight < config->concurrency &&
+            (hedge_at == 0 || wake_at < hedge_at)) {
+            hedge_at = wake_at;
+        }
+        if (hedge_at > 0) {
+            long wake_ms = (long)((hedge_at - now_seconds()) * 1000) + 1;
+            if (wake_ms < 0) {
+                wake_ms = 0;
+            }
+            if (timeout_ms < 0 || wake_ms < timeout_ms) {
+                timeout_ms = wake_ms;
+            }
+        }
+
+        // New handles only start once curl gets a timeout action
+        int n = 0;
+        if (loop.timeout_ms != 0) {
+            n = epoll_wait(loop.epoll_fd, events, MAX_EVENTS, timeout_ms);
+            if (n == -1 && errno != EINTR) {
+                perror("epoll_wait");
+                break;
+            }
+        }
+
+        if (n <= 0) {
+            loop.timeout_ms = -1;
+            curl_multi_socket_action(loop.multi, CURL_SOCKET_TIMEOUT, 0, &running);
+        }
+        for (int i = 0; i < n; i++) {
+            int flags = 0;
+            if (events[i].events & EPOLLIN) {
+                flags |= CURL_CSELECT_IN;
+            }
+            if (events[i].events & EPOLLOUT) {
+                flags |= CURL_CSELECT_OUT;
+            }
+            if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                flags |= CURL_CSELECT_ERR;
+            }
+            curl_multi_socket_action(loop.multi, events[i].data.fd, flags, &running);
+        }
+
+        in_flight -= drain_completed(&loop);
+    }
+
+    for (int i = 0; i < loop.num_idle; i++) {
+        curl_easy_cleanup(loop.idle[i]);
+    }
+    free(loop.idle);
+    curl_multi_cleanup(loop.multi);
+    close(loop.epoll_fd);
+    return url_total;
+}
+
+// scraper [-j workers] [-e threads|multi] [-c concurrency] [-F]
+//         [-H per_host] [-r rate] [-B] [-p stages]
+//         [-d depth] [-D same-host|any|domain] [-m max_pages] [-b bloom_mb]
+//         [-S store_dir] [-z] [-C cache_file] [-M metrics_file]
+//         [-T connect_secs] [-t total_secs] [-L bytes_per_sec:secs] [-a attempts]
+//         [-E percentile] [urls_file]
+// scraper -R store_dir [url...]
+// SCRAPER_WORKERS also sets the pool size
+int parse_args(int argc, char **argv, Config *config) {
+    config->urls_file = "urls.txt";
+    config->workers = sysconf(_SC_NPROCESSORS_ONLN);
+    config->engine = ENGINE_THREADS;
+    config->concurrency = 256;
+    config->fresh = 0;
+    config->per_host = 6;
+    config->rate = 0;
+    config->honor_retry = 1;
+    parse_stages("raw", config);
+    config->max_depth = 0;
+    config->domain_limit = DOMAIN_SAME_HOST;
+    config->domain = NULL;
+    config->max_pages = 0;
+    config->bloom_mb = 0;
+    config->store_dir = "store";
+    config->store_gzip = 0;
+    config->cache_file = NULL;
+    config->metrics_file = NULL;
+    config->connect_timeout = 30;
+    config->total_timeout = 0;
+    config->low_speed_limit = 1;
+    config->low_speed_time = 60;
+    config->max_attempts = MAX_ATTEMPTS;
+    config->hedge_percentile = 0;
+
+    char *env = getenv("SCRAPER_WORKERS");
+    if (env) {
+        config->workers = atoi(env);
+    }
+
+    int opt;
+    while ((opt = getopt(argc, argv, "j:e:c:FH:r:Bp:d:D:m:b:S:zC:M:T:t:L:a:E:R:")) != -1) {
+        switch (opt) {
+            case 'j':
+                config->workers = atoi(optarg);
+                break;
+            case 'e':
+                if (strcmp(optarg, "threads") == 0) {
+                    config->engine = ENGINE_THREADS;
+                } else if (strcmp(optarg, "multi") == 0) {
+                    config->engine = ENGINE_MULTI;
+                } else {
+                    fprintf(stderr, "Unknown engine '%s' (threads or multi)\n", optarg);
+                    return -1;
+                }
+                break;
+            case 'c':
+                config->concurrency = atoi(optarg);
+                break;
+            case 'F':
+                config->fresh = 1;
+                break;
+            case 'H':
+                config->per_host = atoi(optarg);
+                break;
+            case 'r':
+                config->rate = atof(optarg);
+                break;
+            case 'B':
+                config->honor_retry = 0;
+                break;
+            case 'p':
+                if (parse_stages(optarg, config) != 0) {
+                    return -1;
+                }
+                break;
+            case 'd':
+                config->max_depth = atoi(optarg);
+                break;
+            case 'D':
+                if (strcmp(optarg, "same-host") == 0) {
+                    config->domain_limit = DOMAIN_SAME_HOST;
+                } else if (strcmp(optarg, "any") == 0) {
+                    config->domain_limit = DOMAIN_ANY;
+                } else {
+                    config->domain_limit = DOMAIN_SUFFIX;
+                    config->domain = optarg;
+                }
+                break;
+            case 'm':
+                config->max_pages = atol(optarg);
+                break;
+            case 'b':
+                config->bloom_mb = atol(optarg);
+                break;
+            case 'S':
+                config->store_dir = optarg;
+                break;
+            case 'z':
+                config->store_gzip = 1;
+                break;
+            case 'C':
+                config->cache_file = optarg;
+                break;
+            case 'M':
+                config->metrics_file = optarg;
+                break;
+            case 'T':
+                config->connect_timeout = atol(optarg);
+                break;
+            case 't':
+                config->total_timeout = atol(optarg);
+                break;
+            case 'L':
+                if (sscanf(optarg, "%ld:%ld", &config->low_speed_limit,
+                           &config->low_speed_time) != 2) {
+                    fprintf(stderr, "Expected -L bytes_per_sec:seconds\n");
+                    return -1;
+                }
+                break;
+            case 'a':
+                config->max_attempts = atoi(optarg);
+                break;
+            case 'E':
+                config->hedge_percentile = atof(optarg);
+                if (config->hedge_percentile < 0 || config->hedge_percentile >= 100) {
+                    fprintf(stderr, "Hedge percentile must be below 100\n");
+                    return -1;
+                }
+                break;
+            case 'R':
+                exit(run_reader(optarg, argv + optind, argc - optind));
+            default:
+                fprintf(stderr, "Usage: %s [-j workers] [-e threads|multi] [-c concurrency] [-F]\n"
+                        "       [-H per_host] [-r rate] [-B] [-p raw,gzip,hash,links,store]\n"
+                        "       [-d depth] [-D same-host|any|domain] [-m max_pages] [-b bloom_mb]\n"
+                        "       [-S store_dir] [-z] [-C cache_file] [-M metrics_file]\n"
+                        "       [-T connect_secs] [-t total_secs] [-L bytes_per_sec:secs]\n"
+                        "       [-a attempts] [-E percentile] [urls_file]\n"
+                        "       %s -R store_dir [url...]\n", argv[0], argv[0]);
+                return -1;
+        }
+    }
+    if (optind < argc) {
+        config->urls_file = argv[optind];
+    }
+
+    if (config->workers < 1) {
+        config->workers = 1;
+    }
+    if (config->concurrency < 1) {
+        config->concurrency = 1;
+    }
+    if (config->per_host < 0) {
+        config->per_host = 0;
+    }
+    if (config->max_attempts < 1) {
+        config->max_attempts = 1;
+    }
+
+    // Pages that come back 304 are crawled from the store
+    int storing = 0;
+    for (int i = 0; i < config->num_stages; i++) {
+        storing |= config->stages[i]->open == store_open;
+    }
+    if (config->max_depth > 0 && config->cache_file && !storing) {
+        fprintf(stderr, "-d with -C needs -p store, to crawl pages that have not changed\n");
+        return -1;
+    }
+
+    // Crawling needs the links of every page, whatever else is kept
+    if (config->max_depth > 0) {
+        if (config->num_stages == MAX_STAGES) {
+            fprintf(stderr, "Too many processors for crawl mode\n");
+            return -1;
+        }
+        config->stages[config->num_stages++] = &crawl_processor;
+    }
+    return 0;
 }
 
-int main() {
-    char *urls[MAX_URLS];
-    int url_count = 0;
-    FILE *fp = fopen("urls.txt", "r");
+int main(int argc, char **argv) {
+    if (parse_args(argc, argv, &config) != 0) {
+        return 1;
+    }
 
+    FILE *fp = fopen(config.urls_file, "r");
     if (!fp) {
-        fprintf(stderr, "Failed to open urls.txt\n");
+        fprintf(stderr, "Failed to open %s\n", config.urls_file);
         return 1;
     }
 
-    // Read URLs from file
-    char line[1024];
-    while (fgets(line, sizeof(line), fp) && url_count < MAX_URLS) {
-        line[strcspn(line, "\n")] = 0; // Remove newline
-        urls[url_count] = strdup(line);
-        url_count++;
+    for (int i = 0; i < config.num_stages; i++) {
+        if (config.stages[i]->open != store_open) {
+            continue;
+        }
+        if (mkdir(config.store_dir, 0755) == -1 && errno != EEXIST) {
+            fprintf(stderr, "Failed to create %s: %s\n", config.store_dir, strerror(errno));
+            return 1;
+        }
+        store_segments = next_segment(config.store_dir);
     }
-    fclose(fp);
 
-    pthread_t threads[MAX_URLS];
-    ThreadData thread_data[MAX_URLS];
+    if (config.cache_file && cache_load(config.cache_file) != 0) {
+        return 1;
+    }
 
     curl_global_init(CURL_GLOBAL_ALL);
+    init_share();
+    sched_init(&sched);
+    if (config.max_depth > 0) {
+        init_seen();
+    }
 
-    for (int i = 0; i < url_count; ++i) {
-        strcpy(thread_data[i].url, urls[i]);
-        thread_data[i].index = i;
+    struct timespec started, finished;
+    clock_gettime(CLOCK_MONOTONIC, &started);
 
-        if (pthread_create(&threads[i], NULL, fetch_url, &thread_data[i]) != 0) {
-            fprintf(stderr, "Failed to create thread for URL %s\n", urls[i]);
-        }
+    long url_count;
+    if (config.engine == ENGINE_MULTI) {
+        url_count = run_multi(&config, fp);
+    } else {
+        url_count = run_threads(&config, fp);
     }
+    fclose(fp);
+    close_store();
 
-    for (int i = 0; i < url_count; ++i) {
-        pthread_join(threads[i], NULL);
-        free(urls[i]);
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+    double seconds = (finished.tv_sec - started.tv_sec) +
+                     (finished.tv_nsec - started.tv_nsec) / 1e9;
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    if (config.engine == ENGINE_MULTI) {
+        fprintf(stderr, "Fetched %ld of %ld URLs with %d in flight",
+                fetched_count, url_count, config.concurrency);
+    } else {
+        fprintf(stderr, "Fetched %ld of %ld URLs with %d workers",
+                fetched_count, url_count, config.workers);
+    }
+    fprintf(stderr, " in %.2fs (%.1f URLs/sec, peak RSS %ld KB)\n",
+            seconds, seconds > 0 ? url_count / seconds : 0.0, usage.ru_maxrss);
+    fprintf(stderr, "Connections: %ld opened, %ld requests reused one\n",
+            connections_opened, connections_reused);
+    if (retries > 0 || failed_count > 0) {
+        fprintf(stderr, "Retries: %ld, %ld URLs failed for good\n", retries, failed_count);
     }
+    if (config.hedge_percentile > 0) {
+        fprintf(stderr, "Hedged %ld requests after p%g, %ld duplicates answered first\n",
+                hedges_sent, config.hedge_percentile, hedges_won);
+    }
+    if (config.cache_file) {
+        long lookups = cache_hits + cache_misses;
+        fprintf(stderr, "Cache: %ld hits (304), %ld misses, %.1f%% hit rate, %lld bytes downloaded\n",
+                cache_hits, cache_misses, lookups > 0 ? 100.0 * cache_hits / lookups : 0.0,
+                bytes_downloaded);
+        cache_save(config.cache_file);
+    }
+    report_metrics();
 
+    sched_free(&sched);
+    if (config.max_depth > 0) {
+        free_seen();
+    }
+    curl_share_cleanup(share);
     curl_global_cleanup();
 
     return 0;
 }
-